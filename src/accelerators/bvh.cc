@@ -1,165 +1,826 @@
 #include "bvh.hh"
 
+#include <atomic>
+#include <unordered_set>
 
-BVH::BVH(std::vector<std::shared_ptr<Primitive>> &&p, size_t maxPrimsNode)
-  : primitives{std::move(p)}, nodes{}, maxPrimsInNode(std::min((size_t)255, maxPrimsNode)) {
-  
-  if (primitives.empty()) return;
+namespace {
+  // Ranges smaller than this are built serially inside a single task
+  constexpr uint parallelThreshold = 4096;
+  // Hard limit imposed by LinearBVHNode::nPrims
+  constexpr uint maxPrimsInLeaf = 255;
+  constexpr size_t maxBuckets = 32;
 
-  std::vector<BVHPrimitiveInfo> primitiveInfo(primitives.size());
-  for (size_t i = 0; i < primitives.size(); i++)
-    primitiveInfo[i] = BVHPrimitiveInfo(i, primitives[i]->bounds());
+  // Surface area of the intersection of a and b, 0 if they are disjoint
+  Float overlapArea(const Bounds &a, const Bounds &b) {
+    Direction d;
+    for (int i = 0; i < 3; i++) {
+      d[i] = std::min(a.max[i], b.max[i]) - std::max(a.min[i], b.min[i]);
+      if (d[i] < 0) return 0;
+    }
+    return 2 * (d.x * d.y + d.x * d.z + d.y * d.z);
+  }
 
-  uint totalNodes = 0;
-  std::vector<std::shared_ptr<Primitive>> orderedPrims;
-  orderedPrims.reserve(primitives.size());
+  class BVHBuilder {
+    public:
+      BVHBuilder(std::vector<BVHPrimitiveInfo> &primInfo_, const BVHConfig &config_)
+        : primInfo{primInfo_}, config{config_} {}
 
-  std::shared_ptr<BVHNode> root = build(0, primitives.size(), totalNodes, primitiveInfo, orderedPrims);
+      std::vector<LinearBVHNode> build() {
+        std::vector<LinearBVHNode> nodes;
+        if (primInfo.empty()) return nodes;
 
-  primitives.swap(orderedPrims);
-  primitiveInfo.resize(0); // TODO: useless
-  
-  nodes.resize(totalNodes);
-  uint offset = 0;
-  flattenBVHTree(root, offset);
-  assert(totalNodes == offset, "notalNodes==offset");
-  // TODO: CHECK
-}
+        nodes.reserve(2 * primInfo.size() - 1);
 
-Bounds BVH::bounds() const { return nodes.empty() ? Bounds() : nodes[0].bounds; }
+        #pragma omp parallel
+        #pragma omp single
+        buildParallel(0, primInfo.size(), nodes);
 
-std::shared_ptr<BVHNode> BVH::build(uint start, uint end, uint &totalNodes,
-                                    std::vector<BVHPrimitiveInfo> &primInfo,
-                                    std::vector<std::shared_ptr<Primitive>> &orderedPrims) {
-  assert(start != end, "start != end");
-  totalNodes++;
-
-  Bounds bounds;
-  for (uint i = start; i < end; i++)
-    bounds = bounds.Union(primInfo[i].bounds);
-
-  uint nPrims = end - start;
-  if (nPrims == 1) { // Leaf
-    uint firstPrimOffset = orderedPrims.size();
-    for (uint i = start; i < end; i++) {
-      uint primIdx = primInfo[i].idx;
-      orderedPrims.push_back(primitives[primIdx]);
-    }
-    return std::make_shared<BVHNode>(firstPrimOffset, nPrims, bounds);
+        return nodes;
+      }
+
+    private:
+      // Builds [start, end) appending its nodes (depth-first) to nodes
+      void buildSerial(uint start, uint end, std::vector<LinearBVHNode> &nodes) {
+        const uint idx = nodes.size();
+        nodes.emplace_back();
+
+        uint mid;
+        if (!split(start, end, nodes[idx], mid)) return; // Leaf
+
+        buildSerial(start, mid, nodes);
+        nodes[idx].offset = nodes.size();
+        buildSerial(mid, end, nodes);
+      }
+
+      // Same as buildSerial, but the right child of every large enough node
+      // is built in its own task and relocated once it finishes
+      void buildParallel(uint start, uint end, std::vector<LinearBVHNode> &nodes) {
+        if (end - start < parallelThreshold) {
+          buildSerial(start, end, nodes);
+          return;
+        }
+
+        const uint idx = nodes.size();
+        nodes.emplace_back();
+
+        uint mid;
+        if (!split(start, end, nodes[idx], mid)) return; // Leaf
+
+        std::vector<LinearBVHNode> right;
+        #pragma omp task default(shared)
+        {
+          right.reserve(2 * (end - mid) - 1);
+          buildParallel(mid, end, right);
+        }
+
+        buildParallel(start, mid, nodes);
+
+        #pragma omp taskwait
+
+        const uint base = nodes.size();
+        nodes[idx].offset = base;
+        nodes.resize(base + right.size());
+        for (size_t i = 0; i < right.size(); i++) {
+          nodes[base + i] = right[i];
+          if (right[i].nPrims == 0) nodes[base + i].offset += base; // Interior
+        }
+      }
+
+      // Fills node and returns true if [start, end) has to be split at mid,
+      // otherwise node is made a leaf and false is returned
+      bool split(uint start, uint end, LinearBVHNode &node, uint &mid) {
+        assert(start != end, "start != end");
+
+        Bounds bounds, centroidBounds;
+        for (uint i = start; i < end; i++) {
+          bounds = bounds.Union(primInfo[i].bounds);
+          centroidBounds = centroidBounds.Union(primInfo[i].centroid);
+        }
+
+        const uint nPrims = end - start;
+        const uint dim = centroidBounds.maximumExtent();
+
+        node.bounds = bounds;
+        node.offset = start;
+        node.nPrims = nPrims;
+        node.axis = dim;
+
+        if (nPrims == 1) return false; // Leaf
+
+        auto equalCounts = [&]() {
+          mid = (start + end) / 2;
+          std::nth_element(&primInfo[start], &primInfo[mid], &primInfo[end-1]+1,
+            [dim](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b) {
+              return a.centroid[dim] < b.centroid[dim];
+            });
+        };
+
+        auto interior = [&]() {
+          node.nPrims = 0;
+          return true;
+        };
+
+        if (centroidBounds.max[dim] == centroidBounds.min[dim]) {
+          if (nPrims <= maxPrimsInLeaf) return false; // Leaf
+          equalCounts();
+          return interior();
+        }
+
+        switch (config.splitMethod) {
+          case SplitMethod::Middle: {
+            if (nPrims <= config.maxPrimsInNode) return false; // Leaf
+
+            Float pmid = (centroidBounds.min[dim] + centroidBounds.max[dim]) / 2;
+            BVHPrimitiveInfo *midPtr = std::partition(
+                &primInfo[start], &primInfo[end - 1] + 1,
+                [dim, pmid](const BVHPrimitiveInfo &pi) {
+                    return pi.centroid[dim] < pmid;
+                });
+            mid = midPtr - &primInfo[0];
+            // For lots of prims with large overlapping bounding boxes, this
+            // may fail to partition; in that case fall through to EqualCounts.
+            if (mid == start || mid == end)
+              equalCounts();
+            return interior();
+          }
+          case SplitMethod::EqualCounts: {
+            if (nPrims <= config.maxPrimsInNode) return false; // Leaf
+
+            equalCounts();
+            return interior();
+          }
+          case SplitMethod::SAH:
+          default: {
+            if (nPrims <= 2) {
+              equalCounts();
+              return interior();
+            }
+
+            // Binned SAH: bin centroids into buckets along dim and sweep the
+            // nBuckets - 1 candidate planes between them
+            struct Bucket {
+              uint count = 0;
+              Bounds bounds;
+            };
+            const size_t nBuckets = config.nBuckets;
+            Bucket buckets[maxBuckets];
+
+            auto bucketOf = [&](const BVHPrimitiveInfo &pi) {
+              size_t b = nBuckets * centroidBounds.offset(pi.centroid)[dim];
+              return std::min(b, nBuckets - 1);
+            };
+
+            for (uint i = start; i < end; i++) {
+              Bucket &bucket = buckets[bucketOf(primInfo[i])];
+              bucket.count++;
+              bucket.bounds = bucket.bounds.Union(primInfo[i].bounds);
+            }
+
+            // Sweep from the right accumulating the area of the upper partition
+            Float costAbove[maxBuckets - 1];
+            Bounds bAbove;
+            uint countAbove = 0;
+            for (size_t i = nBuckets - 1; i > 0; i--) {
+              bAbove = bAbove.Union(buckets[i].bounds);
+              countAbove += buckets[i].count;
+              costAbove[i - 1] = leafTests(config, countAbove) * bAbove.surfaceArea();
+            }
+
+            size_t minCostSplitBucket = 0;
+            Float minCost = std::numeric_limits<Float>::max();
+            Bounds bBelow;
+            uint countBelow = 0;
+            for (size_t i = 0; i < nBuckets - 1; i++) {
+              bBelow = bBelow.Union(buckets[i].bounds);
+              countBelow += buckets[i].count;
+              if (countBelow == 0 || countBelow == nPrims) continue;
+
+              const Float cost = leafTests(config, countBelow) * bBelow.surfaceArea() + costAbove[i];
+              if (cost < minCost) {
+                minCost = cost;
+                minCostSplitBucket = i;
+              }
+            }
+
+            const Float area = bounds.surfaceArea();
+            minCost = (area > 0) ? config.traversalCost + config.intersectionCost * minCost / area
+                                 : config.traversalCost + config.intersectionCost * leafTests(config, nPrims);
+            const Float leafCost = config.intersectionCost * leafTests(config, nPrims);
+
+            if (nPrims <= config.maxPrimsInNode && leafCost <= minCost)
+              return false; // Leaf
+
+            BVHPrimitiveInfo *midPtr = std::partition(
+                &primInfo[start], &primInfo[end - 1] + 1,
+                [&](const BVHPrimitiveInfo &pi) {
+                  return bucketOf(pi) <= minCostSplitBucket;
+                });
+            mid = midPtr - &primInfo[0];
+            if (mid == start || mid == end)
+              equalCounts();
+            return interior();
+          }
+        }
+      }
+
+    private:
+      std::vector<BVHPrimitiveInfo> &primInfo;
+      const BVHConfig &config;
+  };
+
+  // Spatial split BVH builder (Stich et al., "Spatial Splits in Bounding
+  // Volume Hierarchies", 2009). Besides the binned object split every node
+  // may use a binned spatial split, which cuts the triangles straddling the
+  // plane into a reference for each side with its bounds clipped.
+  class SBVHBuilder {
+    public:
+      // Without indices and vertices, references are clipped as boxes
+      SBVHBuilder(const BVHConfig &config_, const std::vector<size_t> *indices_,
+                  const std::vector<Point> *vertices_, size_t budget)
+        : config{config_}, indices{indices_}, vertices{vertices_}, remaining{budget}, minOverlap{0} {}
+
+      std::vector<LinearBVHNode> build(std::vector<BVHPrimitiveInfo> &primInfo) {
+        std::vector<LinearBVHNode> nodes;
+        if (primInfo.empty()) return nodes;
+
+        Bounds bounds;
+        for (const BVHPrimitiveInfo &ref : primInfo)
+          bounds = bounds.Union(ref.bounds);
+        minOverlap = config.spatialSplitAlpha * bounds.surfaceArea();
+
+        std::vector<BVHPrimitiveInfo> refs;
+        refs.swap(primInfo);
+        nodes.reserve(2 * refs.size() - 1);
+        primInfo.reserve(refs.size());
+
+        #pragma omp parallel
+        #pragma omp single
+        build(std::move(refs), 0, nodes, primInfo);
+
+        return nodes;
+      }
+
+    private:
+      // Spatial splits are not tried past this depth, so that duplicated
+      // references can not make the tree deeper than traversal stacks allow
+      static constexpr uint maxSpatialDepth = 48;
+
+      struct Bin {
+        Bounds bounds;
+        uint enter = 0, exit = 0; // References starting and ending in the bin
+      };
+
+      struct Split {
+        Float cost = std::numeric_limits<Float>::max();
+        uint axis = 0;
+        size_t bin = 0; // Last bin on the left side
+        Bounds left, right;
+        uint nLeft = 0, nRight = 0;
+
+        bool valid() const { return cost < std::numeric_limits<Float>::max(); }
+      };
+
+      // Builds a subtree over refs appending its nodes (depth-first) to nodes
+      // and the references of its leaves to leafRefs. Large right subtrees
+      // are built in their own task and relocated, as in BVHBuilder.
+      void build(std::vector<BVHPrimitiveInfo> &&refs, uint depth,
+                 std::vector<LinearBVHNode> &nodes, std::vector<BVHPrimitiveInfo> &leafRefs) {
+        const uint idx = nodes.size();
+        nodes.emplace_back();
+
+        Bounds bounds, centroidBounds;
+        for (const BVHPrimitiveInfo &ref : refs) {
+          bounds = bounds.Union(ref.bounds);
+          centroidBounds = centroidBounds.Union(ref.centroid);
+        }
+        const uint nRefs = refs.size();
+        nodes[idx].bounds = bounds;
+        nodes[idx].axis = centroidBounds.maximumExtent();
+
+        Split object, spatial;
+        if (nRefs > 1) {
+          objectSplit(refs, centroidBounds, object);
+          if (depth < maxSpatialDepth && remaining > 0 &&
+              (!object.valid() || overlapArea(object.left, object.right) > minOverlap))
+            spatialSplit(refs, bounds, spatial);
+        }
+
+        const Float area = bounds.surfaceArea();
+        auto splitCost = [&](const Split &split) {
+          return (area > 0) ? config.traversalCost + config.intersectionCost * split.cost / area
+                            : config.traversalCost + config.intersectionCost * leafTests(config, nRefs);
+        };
+        const Float leafCost = config.intersectionCost * leafTests(config, nRefs);
+        const bool useSpatial = spatial.valid() && (!object.valid() || spatial.cost < object.cost);
+        const Split &best = useSpatial ? spatial : object;
+
+        if (nRefs == 1 ||
+            (nRefs <= config.maxPrimsInNode && (!best.valid() || leafCost <= splitCost(best))) ||
+            (!best.valid() && nRefs <= maxPrimsInLeaf)) {
+          nodes[idx].offset = leafRefs.size();
+          nodes[idx].nPrims = nRefs;
+          leafRefs.insert(leafRefs.end(), refs.begin(), refs.end());
+          return;
+        }
+
+        std::vector<BVHPrimitiveInfo> left, right;
+        if (useSpatial && partitionSpatial(refs, bounds, spatial, left, right)) {
+          nodes[idx].axis = spatial.axis;
+        } else if (object.valid()) {
+          partitionObject(refs, centroidBounds, object, left, right);
+          nodes[idx].axis = object.axis;
+        } else {
+          // Too many references with the same centroid for a single leaf
+          const uint mid = nRefs / 2;
+          left.assign(refs.begin(), refs.begin() + mid);
+          right.assign(refs.begin() + mid, refs.end());
+        }
+        std::vector<BVHPrimitiveInfo>().swap(refs);
+        nodes[idx].nPrims = 0;
+
+        if (nRefs < parallelThreshold) {
+          build(std::move(left), depth + 1, nodes, leafRefs);
+          nodes[idx].offset = nodes.size();
+          build(std::move(right), depth + 1, nodes, leafRefs);
+          return;
+        }
+
+        std::vector<LinearBVHNode> rightNodes;
+        std::vector<BVHPrimitiveInfo> rightRefs;
+        #pragma omp task default(shared)
+        build(std::move(right), depth + 1, rightNodes, rightRefs);
+
+        build(std::move(left), depth + 1, nodes, leafRefs);
+
+        #pragma omp taskwait
+
+        const uint base = nodes.size(), refBase = leafRefs.size();
+        nodes[idx].offset = base;
+        for (LinearBVHNode node : rightNodes) {
+          node.offset += (node.nPrims > 0) ? refBase : base;
+          nodes.push_back(node);
+        }
+        leafRefs.insert(leafRefs.end(), rightRefs.begin(), rightRefs.end());
+      }
+
+      static bool empty(const Bounds &b) {
+        return b.min.x > b.max.x || b.min.y > b.max.y || b.min.z > b.max.z;
+      }
+
+      size_t binOf(Float x, Float lo, Float hi) const {
+        const Float offset = (x - lo) / (hi - lo);
+        if (offset <= 0) return 0;
+        return std::min(static_cast<size_t>(config.nBuckets * offset), config.nBuckets - 1);
+      }
+
+      Float plane(size_t bin, Float lo, Float hi) const {
+        return (bin == config.nBuckets) ? hi : lo + (hi - lo) * bin / config.nBuckets;
+      }
+
+      // Evaluates the planes between the bins along axis keeping the cheapest
+      // in best. Spatial splits must leave fewer references on each side.
+      void sweep(const Bin *bins, uint axis, uint nRefs, Split &best) const {
+        const size_t nBins = config.nBuckets;
+        Bounds rightBounds[maxBuckets - 1];
+        uint rightCount[maxBuckets - 1];
+        Bounds b;
+        uint count = 0;
+        for (size_t i = nBins - 1; i > 0; i--) {
+          b = b.Union(bins[i].bounds);
+          count += bins[i].exit;
+          rightBounds[i - 1] = b;
+          rightCount[i - 1] = count;
+        }
+
+        Bounds leftBounds;
+        uint leftCount = 0;
+        for (size_t i = 0; i < nBins - 1; i++) {
+          leftBounds = leftBounds.Union(bins[i].bounds);
+          leftCount += bins[i].enter;
+          if (leftCount == 0 || rightCount[i] == 0) continue;
+          if (leftCount >= nRefs || rightCount[i] >= nRefs) continue;
+
+          const Float cost = leafTests(config, leftCount) * leftBounds.surfaceArea() +
+                             leafTests(config, rightCount[i]) * rightBounds[i].surfaceArea();
+          if (cost < best.cost) {
+            best.cost = cost;
+            best.axis = axis;
+            best.bin = i;
+            best.left = leftBounds;
+            best.right = rightBounds[i];
+            best.nLeft = leftCount;
+            best.nRight = rightCount[i];
+          }
+        }
+      }
+
+      // Binned SAH over the centroids along each axis
+      void objectSplit(const std::vector<BVHPrimitiveInfo> &refs, const Bounds &centroidBounds, Split &best) const {
+        for (uint axis = 0; axis < 3; axis++) {
+          const Float lo = centroidBounds.min[axis], hi = centroidBounds.max[axis];
+          if (!(hi > lo)) continue;
+
+          Bin bins[maxBuckets];
+          for (const BVHPrimitiveInfo &ref : refs) {
+            Bin &bin = bins[binOf(ref.centroid[axis], lo, hi)];
+            bin.bounds = bin.bounds.Union(ref.bounds);
+            bin.enter++;
+            bin.exit++;
+          }
+          sweep(bins, axis, refs.size(), best);
+        }
+      }
+
+      // Binned SAH over the node bounds along each axis, the references
+      // spanning several bins are clipped to each of them
+      void spatialSplit(const std::vector<BVHPrimitiveInfo> &refs, const Bounds &bounds, Split &best) const {
+        for (uint axis = 0; axis < 3; axis++) {
+          const Float lo = bounds.min[axis], hi = bounds.max[axis];
+          if (!(hi > lo)) continue;
+
+          Bin bins[maxBuckets];
+          for (const BVHPrimitiveInfo &ref : refs) {
+            const size_t first = binOf(ref.bounds.min[axis], lo, hi);
+            const size_t last = binOf(ref.bounds.max[axis], lo, hi);
+            if (first == last) {
+              bins[first].bounds = bins[first].bounds.Union(ref.bounds);
+            } else {
+              for (size_t b = first; b <= last; b++) {
+                const Bounds piece = clip(ref, axis, plane(b, lo, hi), plane(b + 1, lo, hi));
+                if (!empty(piece)) bins[b].bounds = bins[b].bounds.Union(piece);
+              }
+            }
+            bins[first].enter++;
+            bins[last].exit++;
+          }
+          sweep(bins, axis, refs.size(), best);
+        }
+      }
+
+      // Bounds of the part of the triangle of ref between the planes lo and hi
+      // along axis, restricted to the bounds of ref
+      Bounds clip(const BVHPrimitiveInfo &ref, uint axis, Float lo, Float hi) const {
+        if (!indices) {
+          Bounds b = ref.bounds;
+          b.min[axis] = std::max(b.min[axis], lo);
+          b.max[axis] = std::min(b.max[axis], hi);
+          return b;
+        }
+
+        const size_t *v = &(*indices)[3 * ref.idx];
+        Bounds b;
+        for (int e = 0; e < 3; e++) {
+          const Point &p0 = (*vertices)[v[e]], &p1 = (*vertices)[v[(e + 1) % 3]];
+          const Float a0 = p0[axis], a1 = p1[axis];
+          if (a0 >= lo && a0 <= hi) b = b.Union(p0);
+          for (Float cut : {lo, hi}) {
+            if ((a0 < cut && a1 > cut) || (a0 > cut && a1 < cut)) {
+              Point p = p0 + (p1 - p0) * ((cut - a0) / (a1 - a0));
+              p[axis] = cut;
+              b = b.Union(p);
+            }
+          }
+        }
+        for (int i = 0; i < 3; i++) {
+          b.min[i] = std::max(b.min[i], ref.bounds.min[i]);
+          b.max[i] = std::min(b.max[i], ref.bounds.max[i]);
+        }
+        return b;
+      }
+
+      void partitionObject(const std::vector<BVHPrimitiveInfo> &refs, const Bounds &centroidBounds, const Split &split,
+                           std::vector<BVHPrimitiveInfo> &left, std::vector<BVHPrimitiveInfo> &right) const {
+        const Float lo = centroidBounds.min[split.axis], hi = centroidBounds.max[split.axis];
+        left.reserve(split.nLeft);
+        right.reserve(split.nRight);
+        for (const BVHPrimitiveInfo &ref : refs)
+          (binOf(ref.centroid[split.axis], lo, hi) <= split.bin ? left : right).push_back(ref);
+      }
+
+      // Returns false, leaving left and right untouched, if the references
+      // the split duplicates do not fit in the remaining budget
+      bool partitionSpatial(const std::vector<BVHPrimitiveInfo> &refs, const Bounds &bounds, const Split &split,
+                            std::vector<BVHPrimitiveInfo> &left, std::vector<BVHPrimitiveInfo> &right) {
+        const size_t duplicates = split.nLeft + split.nRight - refs.size();
+        size_t available = remaining.load();
+        while (available >= duplicates && !remaining.compare_exchange_weak(available, available - duplicates)) {}
+        if (available < duplicates) return false;
+
+        const uint axis = split.axis;
+        const Float lo = bounds.min[axis], hi = bounds.max[axis];
+        const Float cut = plane(split.bin + 1, lo, hi);
+        left.reserve(split.nLeft);
+        right.reserve(split.nRight);
+        for (const BVHPrimitiveInfo &ref : refs) {
+          const size_t first = binOf(ref.bounds.min[axis], lo, hi);
+          const size_t last = binOf(ref.bounds.max[axis], lo, hi);
+          if (last <= split.bin) {
+            left.push_back(ref);
+          } else if (first > split.bin) {
+            right.push_back(ref);
+          } else {
+            const Bounds l = clip(ref, axis, lo, cut), r = clip(ref, axis, cut, hi);
+            if (empty(r))      left.push_back(ref);
+            else if (empty(l)) right.push_back(ref);
+            else {
+              left.emplace_back(ref.idx, l);
+              right.emplace_back(ref.idx, r);
+            }
+          }
+        }
+        return true;
+      }
+
+    private:
+      const BVHConfig &config;
+      const std::vector<size_t> *indices;
+      const std::vector<Point> *vertices;
+      std::atomic<size_t> remaining; // References spatial splits may still add
+      Float minOverlap;
+  };
+
+  // Adds up the overlap of every pair of leaves of a BVH by descending into
+  // pairs of subtrees only where their bounds intersect
+  class OverlapSum {
+    public:
+      OverlapSum(const std::vector<LinearBVHNode> &nodes_, const std::vector<BVHPrimitiveInfo> &boxes_)
+        : nodes{nodes_}, boxes{boxes_} {}
+
+      // Pairs with both leaves under node
+      Float within(uint node) const {
+        const LinearBVHNode &n = nodes[node];
+        if (n.nPrims > 0) {
+          Float sum = 0;
+          for (uint i = n.offset; i < n.offset + n.nPrims; i++)
+            for (uint j = i + 1; j < n.offset + n.nPrims; j++)
+              sum += overlapArea(boxes[i].bounds, boxes[j].bounds);
+          return sum;
+        }
+        return within(node + 1) + within(n.offset) + between(node + 1, n.offset);
+      }
+
+      // Pairs with a leaf under a and the other under b
+      Float between(uint a, uint b) const {
+        const LinearBVHNode &na = nodes[a], &nb = nodes[b];
+        if (!na.bounds.overlaps(nb.bounds)) return 0;
+
+        if (na.nPrims > 0 && nb.nPrims > 0) {
+          Float sum = 0;
+          for (uint i = na.offset; i < na.offset + na.nPrims; i++)
+            for (uint j = nb.offset; j < nb.offset + nb.nPrims; j++)
+              sum += overlapArea(boxes[i].bounds, boxes[j].bounds);
+          return sum;
+        }
+
+        // Open the larger interior node
+        if (nb.nPrims > 0 || (na.nPrims == 0 && na.bounds.surfaceArea() > nb.bounds.surfaceArea()))
+          return between(a + 1, b) + between(na.offset, b);
+        return between(a, b + 1) + between(a, nb.offset);
+      }
+
+    private:
+      const std::vector<LinearBVHNode> &nodes;
+      const std::vector<BVHPrimitiveInfo> &boxes;
+  };
+
+  // Clamps the settings the builders rely on
+  BVHConfig clampConfig(const BVHConfig &cfg) {
+    BVHConfig config = cfg;
+    config.maxPrimsInNode = std::min((size_t)maxPrimsInLeaf, std::max((size_t)1, config.maxPrimsInNode));
+    config.nBuckets = std::min(maxBuckets, std::max((size_t)2, config.nBuckets));
+    config.leafPackWidth = std::max((size_t)1, config.leafPackWidth);
+    return config;
   }
+} // namespace
 
-  Bounds centroidBounds;
-  for (uint i = start; i < end; i++)
-    centroidBounds = centroidBounds.Union(primInfo[i].centroid);
-  uint dim = centroidBounds.maximumExtent(); 
-
-  uint mid = (start + end) / 2;
-  if (centroidBounds.max[dim] == centroidBounds.min[dim]) { // Leaf
-    uint firstPrimOffset = orderedPrims.size();
-    for (uint i = start; i < end; i++) {
-      uint primIdx = primInfo[i].idx;
-      orderedPrims.push_back(primitives[primIdx]);
-    }
-    return std::make_shared<BVHNode>(firstPrimOffset, nPrims, bounds);
-  } 
-  
-  #if 0 // Middle
-    Float pmid = (centroidBounds.min[dim] + centroidBounds.max[dim]) / 2;
-    BVHPrimitiveInfo *midPtr = std::partition(
-        &primInfo[start], &primInfo[end - 1] + 1,
-        [dim, pmid](const BVHPrimitiveInfo &pi) {
-            return pi.centroid[dim] < pmid;
-        });
-    mid = midPtr - &primInfo[0];
-    // For lots of prims with large overlapping bounding boxes, this
-    // may fail to partition; in that case don't break and fall
-    // through
-    // to EqualCounts.
-    if (mid != start && mid != end) {
+std::vector<LinearBVHNode> buildBVH(std::vector<BVHPrimitiveInfo> &primInfo, const BVHConfig &cfg) {
+  return BVHBuilder(primInfo, clampConfig(cfg)).build();
+}
 
+std::vector<LinearBVHNode> buildSBVH(std::vector<BVHPrimitiveInfo> &primInfo, const BVHConfig &cfg,
+                                     const std::vector<size_t> &indices, const std::vector<Point> &vertices) {
+  const BVHConfig config = clampConfig(cfg);
+  const size_t budget = std::max(Float(0), config.spatialSplitBudget) * primInfo.size();
+  return SBVHBuilder(config, &indices, &vertices, budget).build(primInfo);
+}
+
+std::vector<LinearBVHNode> buildSBVH(std::vector<BVHPrimitiveInfo> &primInfo, const BVHConfig &cfg) {
+  const BVHConfig config = clampConfig(cfg);
+  const size_t budget = std::max(Float(0), config.spatialSplitBudget) * primInfo.size();
+  return SBVHBuilder(config, nullptr, nullptr, budget).build(primInfo);
+}
+
+std::vector<LinearBVHNode> buildAggregateBVH(std::vector<std::shared_ptr<Primitive>> &primitives, const BVHConfig &config) {
+  std::unordered_set<const Primitive *> seen;
+  std::vector<std::shared_ptr<Primitive>> unique;
+  unique.reserve(primitives.size());
+  for (std::shared_ptr<Primitive> &p : primitives)
+    if (seen.insert(p.get()).second) unique.push_back(std::move(p));
+
+  std::vector<BVHPrimitiveInfo> primitiveInfo(unique.size());
+  #pragma omp parallel for
+  for (size_t i = 0; i < unique.size(); i++)
+    primitiveInfo[i] = BVHPrimitiveInfo(i, unique[i]->bounds());
+
+  std::vector<LinearBVHNode> nodes = (config.splitMethod == SplitMethod::SBVH)
+                                   ? buildSBVH(primitiveInfo, config)
+                                   : buildBVH(primitiveInfo, config);
+
+  // References are copied rather than moved, several may share a primitive
+  primitives.resize(primitiveInfo.size());
+  #pragma omp parallel for
+  for (size_t i = 0; i < primitiveInfo.size(); i++)
+    primitives[i] = unique[primitiveInfo[i].idx];
+  return nodes;
+}
+
+BVHStats &BVHStats::operator+=(const BVHStats &stats) {
+  const Float area = rootArea + stats.rootArea;
+  sahCost = (area > 0) ? (sahCost * rootArea + stats.sahCost * stats.rootArea) / area : 0;
+  rootArea = area;
+
+  const size_t leaves = nLeaves + stats.nLeaves;
+  avgDepth = (leaves > 0) ? (avgDepth * nLeaves + stats.avgDepth * stats.nLeaves) / leaves : 0;
+  nLeaves = leaves;
+
+  nNodes += stats.nNodes;
+  maxDepth = std::max(maxDepth, stats.maxDepth);
+  if (leafSizes.size() < stats.leafSizes.size()) leafSizes.resize(stats.leafSizes.size(), 0);
+  for (size_t n = 0; n < stats.leafSizes.size(); n++)
+    leafSizes[n] += stats.leafSizes[n];
+  leafOverlap += stats.leafOverlap;
+  memory += stats.memory;
+  return *this;
+}
+
+std::ostream &operator<<(std::ostream &os, const BVHStats &stats) {
+  os << stats.nNodes << " nodes, " << stats.nLeaves << " leaves, depth "
+     << stats.maxDepth << " max / " << stats.avgDepth << " avg, SAH cost " << stats.sahCost
+     << ", leaf overlap " << ((stats.rootArea > 0) ? stats.leafOverlap / stats.rootArea : 0) << "x root area, "
+     << stats.memory / 1024.0 << " KiB\n";
+
+  os << "  primitives per leaf:";
+  for (size_t n = 0; n < stats.leafSizes.size(); n++)
+    if (stats.leafSizes[n] > 0) os << " " << n << ":" << stats.leafSizes[n];
+  return os;
+}
+
+Float leafOverlap(const std::vector<Bounds> &leaves) {
+  if (leaves.size() < 2) return 0;
+
+  std::vector<BVHPrimitiveInfo> boxes(leaves.size());
+  #pragma omp parallel for
+  for (size_t i = 0; i < leaves.size(); i++)
+    boxes[i] = BVHPrimitiveInfo(i, leaves[i]);
+
+  BVHConfig config;
+  config.maxPrimsInNode = 1;
+  const std::vector<LinearBVHNode> nodes = buildBVH(boxes, config);
+  return OverlapSum(nodes, boxes).within(0);
+}
+
+BVHStats bvhStats(const LinearBVHNode *nodes, size_t nNodes, const BVHConfig &config) {
+  BVHStats stats;
+  if (nNodes == 0) return stats;
+
+  stats.nNodes = nNodes;
+  stats.memory = nNodes * sizeof(LinearBVHNode);
+  stats.rootArea = nodes[0].bounds.surfaceArea();
+
+  std::vector<Bounds> leaves;
+  Float cost = 0, depthSum = 0;
+  std::vector<std::pair<uint, size_t>> stack = {{0, 0}}; // Node and its depth
+  while (!stack.empty()) {
+    const auto [i, depth] = stack.back();
+    stack.pop_back();
+
+    const LinearBVHNode &node = nodes[i];
+    if (node.nPrims > 0) {
+      leaves.push_back(node.bounds);
+      cost += config.intersectionCost * leafTests(config, node.nPrims) * node.bounds.surfaceArea();
+      depthSum += depth;
+      stats.maxDepth = std::max(stats.maxDepth, depth);
+      if (stats.leafSizes.size() <= node.nPrims) stats.leafSizes.resize(node.nPrims + 1, 0);
+      stats.leafSizes[node.nPrims]++;
     } else {
-      mid = (start + end) / 2;
-      std::nth_element(&primInfo[start], &primInfo[mid], &primInfo[end-1]+1,
-        [dim](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b) {
-          return a.centroid[dim] < b.centroid[dim];
-        });
+      cost += config.traversalCost * node.bounds.surfaceArea();
+      stack.push_back({i + 1, depth + 1});
+      stack.push_back({node.offset, depth + 1});
     }
-  #endif
-  #if 1 // EQUAL COUNTS
-    mid = (start + end) / 2;
-    std::nth_element(&primInfo[start], &primInfo[mid], &primInfo[end-1]+1,
-      [dim](const BVHPrimitiveInfo &a, const BVHPrimitiveInfo &b) {
-        return a.centroid[dim] < b.centroid[dim];
-      });
-  #endif
-
-  // TODO: SAH 
-
-  return std::make_shared<BVHNode>(dim,
-                                   build(start, mid, totalNodes, primInfo, orderedPrims),
-                                   build(mid, end, totalNodes, primInfo, orderedPrims));
-}
-
-uint BVH::flattenBVHTree(const std::shared_ptr<BVHNode> &node, uint &offset) {
-  LinearBVHNode &linearNode = nodes[offset];
-  linearNode.bounds = node->bounds;
-
-  uint off = offset++;
-
-  if (node->nPrimitives > 0) {
-    assert(!node->children[0] && !node->children[1], "nullptr children");
-    assert(node->nPrimitives < 65536, "TODO");
-    linearNode.offset = node->fPrimOffset;
-    linearNode.nPrims = node->nPrimitives;
-  } else {
-    linearNode.axis = node->splitAxis;
-    linearNode.nPrims = 0;
-    flattenBVHTree(node->children[0], offset);
-    linearNode.offset = flattenBVHTree(node->children[1], offset);
   }
 
-  return off;
+  stats.nLeaves = leaves.size();
+  stats.avgDepth = depthSum / stats.nLeaves;
+  stats.sahCost = (stats.rootArea > 0) ? cost / stats.rootArea : 0;
+  stats.leafOverlap = leafOverlap(leaves);
+  return stats;
 }
 
-bool BVH::intersect(const Ray &ray, SurfaceInteraction &interact) const {
-  if (nodes.empty()) return false;
-  bool hit = false;
-  Direction invDir(1.0 / ray.d.x, 1.0 / ray.d.y, 1.0 / ray.d.z);
-  int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+bool Aggregate::update() {
+  refit();
+  if (cost() <= config.maxRefitDegradation * builtCost) return false;
 
-  uint toVisitOffset = 0, currentNodeIndex = 0;
-  uint nodesToVisit[64];
+  rebuild();
+  return true;
+}
+
+BVH::BVH(std::vector<std::shared_ptr<Primitive>> &&p, const BVHConfig &cfg)
+  : Aggregate(cfg), primitives{std::move(p)}, nodes{} { rebuild(); }
 
-  SurfaceInteraction tmpInteract;
-  tmpInteract.t = std::numeric_limits<Float>::max();
-  interact.t = std::numeric_limits<Float>::max();
-  for(;;) {
-    const LinearBVHNode &node = nodes[currentNodeIndex];
-    if (node.bounds.intersect(ray, invDir, dirIsNeg)) {
+void BVH::rebuild() {
+  nodes.clear();
+  builtCost = 0;
+  if (primitives.empty()) return;
+
+  nodes = buildAggregateBVH(primitives, config);
+  builtCost = cost();
+}
+
+void BVH::refit() {
+  // Bounds are recomputed level by level from the deepest one up, nodes
+  // within a level are independent
+  const auto levels = nodeLevels(nodes.size(), [&](uint i, auto &&visit) {
+    if (nodes[i].nPrims > 0) return;
+    visit(i + 1);
+    visit(nodes[i].offset);
+  });
+
+  for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+    #pragma omp parallel for if (level->size() > 256)
+    for (size_t k = 0; k < level->size(); k++) {
+      const uint i = (*level)[k];
+      LinearBVHNode &node = nodes[i];
       if (node.nPrims > 0) {
-        for (uint i = 0; i < node.nPrims; i++)
-          if (primitives[node.offset + i]->intersect(ray, tmpInteract))
-            if (tmpInteract.t < interact.t) {
-              hit = true;
-              interact = tmpInteract;
-            }
-        if (toVisitOffset == 0)
-          break;
-        currentNodeIndex = nodesToVisit[--toVisitOffset];
+        Bounds b;
+        for (uint j = 0; j < node.nPrims; j++)
+          b = b.Union(primitives[node.offset + j]->bounds());
+        node.bounds = b;
       } else {
-        if (dirIsNeg[node.axis]) {
-          nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
-          currentNodeIndex = node.offset;
-        } else {
-          nodesToVisit[toVisitOffset++] = node.offset;
-          currentNodeIndex = currentNodeIndex + 1;
-        }
+        node.bounds = nodes[i + 1].bounds.Union(nodes[node.offset].bounds);
       }
-    } else {
-      if (toVisitOffset == 0)
-        break;
-      currentNodeIndex = nodesToVisit[--toVisitOffset];
     }
   }
-  return hit;
+}
+
+Float BVH::cost() const {
+  if (nodes.empty()) return 0;
+
+  Float c = 0;
+  #pragma omp parallel for reduction(+:c)
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const Float perArea = (nodes[i].nPrims > 0) ? config.intersectionCost * leafTests(config, nodes[i].nPrims)
+                                                : config.traversalCost;
+    c += perArea * nodes[i].bounds.surfaceArea();
+  }
+
+  const Float rootArea = nodes[0].bounds.surfaceArea();
+  return (rootArea > 0) ? c / rootArea : 0;
+}
+
+BVHStats BVH::stats() const {
+  BVHStats stats = bvhStats(nodes.data(), nodes.size(), config);
+  stats.memory += primitives.size() * sizeof(std::shared_ptr<Primitive>);
+  return stats;
+}
+
+void BVH::intersectPacket(RayPacket &packet, uint32_t lanes, HitRecord hits[]) const {
+  traverseBVHPacket(nodes.data(), nodes.size(), packet, lanes, [&](uint offset, uint nPrims, uint32_t active) {
+    for (uint i = offset; i < offset + nPrims; i++)
+      primitives[i]->intersectPacket(packet, active, hits);
+  });
+}
+
+uint32_t BVH::intersectPPacket(const RayPacket &packet, uint32_t lanes) const {
+  return traverseBVHPacketP(nodes.data(), nodes.size(), packet, lanes, [&](uint offset, uint nPrims, uint32_t active) {
+    uint32_t blocked = 0;
+    for (uint i = offset; i < offset + nPrims && blocked != active; i++)
+      blocked |= primitives[i]->intersectPPacket(packet, active & ~blocked);
+    return blocked;
+  });
+}
+
+Bounds BVH::bounds() const { return nodes.empty() ? Bounds() : nodes[0].bounds; }
+
+bool BVH::intersect(const Ray &ray, HitRecord &hit) const {
+  return traverseBVH<false>(nodes.data(), nodes.size(), ray, [&](uint offset, uint nPrims) {
+    // Every hit shrinks ray.tMax, so any reported hit is the closest so far
+    bool leafHit = false;
+    for (uint i = 0; i < nPrims; i++)
+      if (primitives[offset + i]->intersect(ray, hit))
+        leafHit = true;
+    return leafHit;
+  });
+}
+
+bool BVH::intersectP(const Ray &ray) const {
+  return traverseBVH<true>(nodes.data(), nodes.size(), ray, [&](uint offset, uint nPrims) {
+    for (uint i = 0; i < nPrims; i++)
+      if (primitives[offset + i]->intersectP(ray))
+        return true;
+    return false;
+  });
+}
+
+void BVH::interaction(const Ray &ray, const HitRecord &hit, SurfaceInteraction &interact) const {
+  hit.primitive->interaction(ray, hit, interact); // The primitive hit inside the BVH
 }
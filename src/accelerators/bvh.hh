@@ -4,6 +4,42 @@
 #include "ver.hh"
 #include "shapes/primitive.hh"
 
+#include <string>
+#include <vector>
+
+// SBVH adds spatial splits to SAH (see buildSBVH). Meshes clip their
+// triangles, the scene-level BVHs clip primitive bounds and sphere sets
+// treat it as SAH.
+enum class SplitMethod { SAH, Middle, EqualCounts, SBVH };
+
+struct BVHConfig {
+  SplitMethod splitMethod = SplitMethod::SAH;
+  size_t maxPrimsInNode = 4;
+  // SAH cost model: C = Ct + Ci * (N_a * S_a + N_b * S_b) / S
+  Float traversalCost = 1.0;
+  Float intersectionCost = 1.0;
+  size_t nBuckets = 12;
+  // Primitives a leaf tests at once (SIMD packed leaves): a leaf of n
+  // primitives costs ceil(n / leafPackWidth) intersections
+  size_t leafPackWidth = 1;
+  // Branching factor of the final tree: 2 (BVH), 4 (BVH4) or 8 (BVH8)
+  size_t width = 2;
+  // Aggregate::update rebuilds once refitting makes the SAH cost this much worse
+  Float maxRefitDegradation = 1.5;
+  // Extra references spatial splits may create, relative to the primitive count
+  Float spatialSplitBudget = 0.3;
+  // Spatial splits are only tried where the children of the best object split
+  // overlap by more than this fraction of the root surface area
+  Float spatialSplitAlpha = 1e-5;
+  // Directory of the on-disk cache used by TriangleMeshPrimitive::load, none if empty
+  std::string cacheDir;
+};
+
+// Intersection tests of a leaf with nPrims primitives, as the SAH counts them
+inline Float leafTests(const BVHConfig &config, size_t nPrims) {
+  return static_cast<Float>((nPrims + config.leafPackWidth - 1) / config.leafPackWidth);
+}
+
 struct BVHPrimitiveInfo {
   BVHPrimitiveInfo() = default;
   BVHPrimitiveInfo(size_t primIdx, const Bounds &b)
@@ -14,23 +50,6 @@ struct BVHPrimitiveInfo {
   Point centroid;
 };
 
-struct BVHNode {
-  BVHNode(uint first, uint n, const Bounds &b)
-    : bounds{b}, children{nullptr, nullptr},
-      fPrimOffset{first}, nPrimitives{n} {}
-  
-  BVHNode(uint axis, 
-          const std::shared_ptr<BVHNode> c0, 
-          const std::shared_ptr<BVHNode> c1)
-    : bounds{c0->bounds.Union(c1->bounds)},
-      children{c0, c1}, splitAxis{axis},
-      fPrimOffset{0}, nPrimitives{0} {}
-
-  Bounds bounds;
-  std::shared_ptr<BVHNode> children[2];
-  uint splitAxis, fPrimOffset, nPrimitives;
-};
-
 struct LinearBVHNode {
   Bounds bounds;
   uint offset;
@@ -38,22 +57,229 @@ struct LinearBVHNode {
   uint16_t axis;
 };
 
-class BVH : public Primitive {
+// Quality figures of a BVH, to compare builders and their settings
+struct BVHStats {
+  size_t nNodes = 0;             // Including the leaves
+  size_t nLeaves = 0;
+  size_t maxDepth = 0;
+  Float avgDepth = 0;            // Over the leaves
+  std::vector<size_t> leafSizes; // leafSizes[n] is the number of leaves with n primitives
+  Float sahCost = 0;             // Relative to the root, as Aggregate::cost
+  Float rootArea = 0;
+  Float leafOverlap = 0;         // Surface area shared by every pair of leaves
+  size_t memory = 0;             // Bytes of the nodes and the leaf data
+
+  // Merges the statistics of another tree, costs are weighted by root area
+  BVHStats &operator+=(const BVHStats &stats);
+  friend std::ostream &operator<<(std::ostream &os, const BVHStats &stats);
+};
+
+// Sum of the surface areas of the intersections of every pair of boxes
+Float leafOverlap(const std::vector<Bounds> &leaves);
+
+// Builds a flattened (depth-first) BVH over primInfo. primInfo is reordered in
+// place so that every leaf covers the range [offset, offset + nPrims) of it.
+// Subtrees are built in parallel with OpenMP tasks.
+std::vector<LinearBVHNode> buildBVH(std::vector<BVHPrimitiveInfo> &primInfo, const BVHConfig &config);
+
+// Spatial split BVH over the triangles given by indices and vertices, one
+// BVHPrimitiveInfo per triangle. primInfo is replaced by the references of
+// the leaves: a triangle crossing a spatial split is referenced from both
+// sides, with bounds clipped to each of them.
+std::vector<LinearBVHNode> buildSBVH(std::vector<BVHPrimitiveInfo> &primInfo, const BVHConfig &config,
+                                     const std::vector<size_t> &indices, const std::vector<Point> &vertices);
+// Same over arbitrary primitives: references are clipped by cutting their
+// bounds at the split plane. Looser than clipping the triangles, but exact
+// for axis aligned quads such as the walls of the Cornell boxes.
+std::vector<LinearBVHNode> buildSBVH(std::vector<BVHPrimitiveInfo> &primInfo, const BVHConfig &config);
+
+// Tree of a scene-level aggregate, built with buildSBVH or buildBVH as given
+// by config.splitMethod. primitives is reordered so that every leaf covers a
+// range of it, with SBVH a primitive may be referenced from several leaves
+// and then appears as many times (refitting gives those leaves the whole
+// bounds of the primitive, which is conservative). Duplicates of an earlier
+// build are dropped first.
+std::vector<LinearBVHNode> buildAggregateBVH(std::vector<std::shared_ptr<Primitive>> &primitives, const BVHConfig &config);
+
+// Statistics of a tree built by buildBVH or buildSBVH. The memory only counts
+// the nodes, callers add the size of what the leaves point to.
+BVHStats bvhStats(const LinearBVHNode *nodes, size_t nNodes, const BVHConfig &config);
+
+// Front to back traversal of a BVH built with buildBVH. intersectLeaf(offset,
+// nPrims) tests the primitives of a leaf and returns true if any is hit, for
+// closest-hit queries it must shrink ray.tMax. Any-hit queries stop at the
+// first leaf that reports a hit.
+template <bool AnyHit, typename IntersectLeaf>
+bool traverseBVH(const LinearBVHNode *nodes, size_t nNodes, const Ray &ray, IntersectLeaf &&intersectLeaf) {
+  if (nNodes == 0) return false;
+  bool hit = false;
+  Direction invDir(1.0 / ray.d.x, 1.0 / ray.d.y, 1.0 / ray.d.z);
+  int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+
+  uint toVisitOffset = 0, currentNodeIndex = 0;
+  uint nodesToVisit[64];
+
+  for(;;) {
+    const LinearBVHNode &node = nodes[currentNodeIndex];
+    if (node.bounds.intersect(ray, invDir, dirIsNeg)) {
+      if (node.nPrims > 0) {
+        if (intersectLeaf(node.offset, node.nPrims)) {
+          if (AnyHit) return true;
+          hit = true;
+        }
+        if (toVisitOffset == 0)
+          break;
+        currentNodeIndex = nodesToVisit[--toVisitOffset];
+      } else {
+        if (dirIsNeg[node.axis]) {
+          nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+          currentNodeIndex = node.offset;
+        } else {
+          nodesToVisit[toVisitOffset++] = node.offset;
+          currentNodeIndex = currentNodeIndex + 1;
+        }
+      }
+    } else {
+      if (toVisitOffset == 0)
+        break;
+      currentNodeIndex = nodesToVisit[--toVisitOffset];
+    }
+  }
+  return hit;
+}
+
+// Packet version of traverseBVH: the tree is walked once for all the given
+// lanes, each node is tested against the lanes that reached it and lanes
+// drop out as their tMax shrinks. Children are ordered by the direction of
+// the first lane. intersectLeaf(offset, nPrims, lanes) tests the primitives
+// of a leaf against the lanes that hit its bounds.
+template <typename IntersectLeaf>
+void traverseBVHPacket(const LinearBVHNode *nodes, size_t nNodes, RayPacket &packet, uint32_t lanes,
+                       IntersectLeaf &&intersectLeaf) {
+  if (nNodes == 0 || lanes == 0) return;
+  const int first = firstLane(lanes);
+  const int dirIsNeg[3] = {packet.invDir[0][first] < 0, packet.invDir[1][first] < 0, packet.invDir[2][first] < 0};
+
+  struct Entry {
+    uint node;
+    uint32_t lanes;
+  };
+  Entry toVisit[64];
+  uint toVisitOffset = 0;
+  toVisit[toVisitOffset++] = {0, lanes};
+
+  while (toVisitOffset > 0) {
+    const Entry entry = toVisit[--toVisitOffset];
+    const LinearBVHNode &node = nodes[entry.node];
+    const uint32_t active = packet.intersect(node.bounds, entry.lanes);
+    if (active == 0) continue;
+
+    if (node.nPrims > 0) {
+      intersectLeaf(node.offset, node.nPrims, active);
+    } else if (dirIsNeg[node.axis]) {
+      toVisit[toVisitOffset++] = {entry.node + 1, active};
+      toVisit[toVisitOffset++] = {node.offset, active};
+    } else {
+      toVisit[toVisitOffset++] = {node.offset, active};
+      toVisit[toVisitOffset++] = {entry.node + 1, active};
+    }
+  }
+}
+
+// Any-hit version of traverseBVHPacket: intersectLeaf(offset, nPrims, lanes)
+// returns the lanes it found blocked, which are not traversed any further.
+// Returns all the blocked lanes.
+template <typename IntersectLeaf>
+uint32_t traverseBVHPacketP(const LinearBVHNode *nodes, size_t nNodes, const RayPacket &packet, uint32_t lanes,
+                            IntersectLeaf &&intersectLeaf) {
+  if (nNodes == 0 || lanes == 0) return 0;
+  const int first = firstLane(lanes);
+  const int dirIsNeg[3] = {packet.invDir[0][first] < 0, packet.invDir[1][first] < 0, packet.invDir[2][first] < 0};
+
+  struct Entry {
+    uint node;
+    uint32_t lanes;
+  };
+  Entry toVisit[64];
+  uint toVisitOffset = 0;
+  toVisit[toVisitOffset++] = {0, lanes};
+
+  uint32_t blocked = 0;
+  while (toVisitOffset > 0) {
+    const Entry entry = toVisit[--toVisitOffset];
+    const LinearBVHNode &node = nodes[entry.node];
+    const uint32_t active = packet.intersect(node.bounds, entry.lanes & ~blocked);
+    if (active == 0) continue;
+
+    if (node.nPrims > 0) {
+      blocked |= intersectLeaf(node.offset, node.nPrims, active);
+      if (blocked == lanes) break;
+    } else if (dirIsNeg[node.axis]) {
+      toVisit[toVisitOffset++] = {entry.node + 1, active};
+      toVisit[toVisitOffset++] = {node.offset, active};
+    } else {
+      toVisit[toVisitOffset++] = {node.offset, active};
+      toVisit[toVisitOffset++] = {entry.node + 1, active};
+    }
+  }
+  return blocked;
+}
+
+// Groups the nodes of a flattened tree by depth. children(i, visit) must call
+// visit(child) for every child of node i, which must come after it.
+template <typename Children>
+std::vector<std::vector<uint>> nodeLevels(size_t nNodes, Children &&children) {
+  std::vector<std::vector<uint>> levels;
+  std::vector<uint> depth(nNodes, 0);
+  for (uint i = 0; i < nNodes; i++) {
+    if (depth[i] >= levels.size()) levels.resize(depth[i] + 1);
+    levels[depth[i]].push_back(i);
+    children(i, [&](uint child) { depth[child] = depth[i] + 1; });
+  }
+  return levels;
+}
+
+// Acceleration structure that can follow its primitives when they move
+class Aggregate : public Primitive {
+  public:
+    explicit Aggregate(const BVHConfig &cfg) : config{cfg}, builtCost{0} {}
+
+    // Recomputes the bounds of every node bottom-up, keeping the topology
+    virtual void refit() = 0;
+    // Builds the tree again over the same primitives
+    virtual void rebuild() = 0;
+    // SAH cost of the tree as it is now
+    virtual Float cost() const = 0;
+    virtual BVHStats stats() const = 0;
+
+    // Refits the tree, or rebuilds it once refitting has degraded its cost
+    // past config.maxRefitDegradation. Returns true if it was rebuilt.
+    bool update();
+
+  protected:
+    BVHConfig config;
+    Float builtCost; // cost() right after the last build
+};
+
+class BVH : public Aggregate {
   public:
-    BVH(std::vector<std::shared_ptr<Primitive>> &&p, size_t maxPrimsNode = 255);
-    Bounds bounds() const;
-    bool intersect(const Ray &ray, SurfaceInteraction &interact) const;
+    BVH(std::vector<std::shared_ptr<Primitive>> &&p, const BVHConfig &cfg = BVHConfig());
+    void refit() override;
+    void rebuild() override;
+    Float cost() const override;
+    BVHStats stats() const override;
 
-  private:
-    std::shared_ptr<BVHNode> build(uint start, uint end, uint &totalNodes,
-                                   std::vector<BVHPrimitiveInfo> &primInfo,
-                                   std::vector<std::shared_ptr<Primitive>> &orderedPrims); 
+    Bounds bounds() const;
+    bool intersect(const Ray &ray, HitRecord &hit) const;
+    bool intersectP(const Ray &ray) const;
+    void interaction(const Ray &ray, const HitRecord &hit,
+                     SurfaceInteraction &interact) const;
+    void intersectPacket(RayPacket &packet, uint32_t lanes, HitRecord hits[]) const override;
+    uint32_t intersectPPacket(const RayPacket &packet, uint32_t lanes) const override;
 
-    uint flattenBVHTree(const std::shared_ptr<BVHNode> &node, uint &offset);
   private:
     std::vector<std::shared_ptr<Primitive>> primitives;
     std::vector<LinearBVHNode> nodes;
-    size_t maxPrimsInNode;
 };
 
 #endif // BVH_H_
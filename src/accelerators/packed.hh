@@ -0,0 +1,210 @@
+#ifndef PACKED_H_
+#define PACKED_H_
+
+#include "ver.hh"
+#include "geometry.hh"
+#include "accelerators/bvh.hh"
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+// Intersection-only leaf records: packWidth primitives per record in SoA
+// layout, so a whole record is tested with one SIMD kernel. Lanes past the
+// end of a leaf hold degenerate primitives that are never hit. Shading still
+// uses the original shapes through id.
+constexpr int packWidth = 4;
+
+struct alignas(4 * packWidth) TrianglePack {
+  float p0[3][packWidth], e1[3][packWidth], e2[3][packWidth];
+  uint32_t id[packWidth];
+};
+
+struct alignas(4 * packWidth) SpherePack {
+  float c[3][packWidth], r2[packWidth]; // Centres and squared radii
+  uint32_t id[packWidth];
+};
+
+// Ray data needed by the kernels, precomputed once per traversal
+struct PackRay {
+  PackRay() = default;
+  explicit PackRay(const Ray &ray) {
+    for (int a = 0; a < 3; a++) {
+      o[a] = static_cast<float>(ray.o[a]);
+      d[a] = static_cast<float>(ray.d[a]);
+    }
+  }
+
+  float o[3], d[3];
+};
+
+// Returns the lanes hit in (tMin, tMax), their distances and barycentrics
+// are written to t, u and v. Same tests as intersectTriangle.
+inline int intersectPack(const TrianglePack &pack, const PackRay &r, float tMin, float tMax,
+                         float t[packWidth], float u[packWidth], float v[packWidth]) {
+  constexpr float eps = std::numeric_limits<float>::epsilon();
+#if defined(__SSE__)
+  const __m128 dx = _mm_set1_ps(r.d[0]), dy = _mm_set1_ps(r.d[1]), dz = _mm_set1_ps(r.d[2]);
+  const __m128 e1x = _mm_load_ps(pack.e1[0]), e1y = _mm_load_ps(pack.e1[1]), e1z = _mm_load_ps(pack.e1[2]);
+  const __m128 e2x = _mm_load_ps(pack.e2[0]), e2y = _mm_load_ps(pack.e2[1]), e2z = _mm_load_ps(pack.e2[2]);
+
+  // ray_x_e2 = ray.d x e2, det = e1 . ray_x_e2
+  const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+  const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+  const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+  const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+  const __m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+  // b = ray.o - p0
+  const __m128 bx = _mm_sub_ps(_mm_set1_ps(r.o[0]), _mm_load_ps(pack.p0[0]));
+  const __m128 by = _mm_sub_ps(_mm_set1_ps(r.o[1]), _mm_load_ps(pack.p0[1]));
+  const __m128 bz = _mm_sub_ps(_mm_set1_ps(r.o[2]), _mm_load_ps(pack.p0[2]));
+
+  const __m128 uu = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(bx, px), _mm_mul_ps(by, py)), _mm_mul_ps(bz, pz)), invDet);
+
+  // ray_x_e1 = b x e1
+  const __m128 qx = _mm_sub_ps(_mm_mul_ps(by, e1z), _mm_mul_ps(bz, e1y));
+  const __m128 qy = _mm_sub_ps(_mm_mul_ps(bz, e1x), _mm_mul_ps(bx, e1z));
+  const __m128 qz = _mm_sub_ps(_mm_mul_ps(bx, e1y), _mm_mul_ps(by, e1x));
+
+  const __m128 vv = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), invDet);
+  const __m128 tt = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), invDet);
+
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+  const __m128 absDet = _mm_andnot_ps(_mm_set1_ps(-0.0f), det);
+
+  // Comparisons with NaN (degenerate lanes) are false, so they are never hit
+  __m128 mask = _mm_cmpge_ps(absDet, _mm_set1_ps(eps));
+  mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(uu, zero), _mm_cmple_ps(uu, one)));
+  mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpge_ps(vv, zero), _mm_cmple_ps(_mm_add_ps(uu, vv), one)));
+  mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(tt, _mm_set1_ps(tMin)), _mm_cmplt_ps(tt, _mm_set1_ps(tMax))));
+
+  _mm_storeu_ps(t, tt);
+  _mm_storeu_ps(u, uu);
+  _mm_storeu_ps(v, vv);
+  return _mm_movemask_ps(mask);
+#else
+  int mask = 0;
+  for (int i = 0; i < packWidth; i++) {
+    const float px = r.d[1] * pack.e2[2][i] - r.d[2] * pack.e2[1][i];
+    const float py = r.d[2] * pack.e2[0][i] - r.d[0] * pack.e2[2][i];
+    const float pz = r.d[0] * pack.e2[1][i] - r.d[1] * pack.e2[0][i];
+    const float det = pack.e1[0][i] * px + pack.e1[1][i] * py + pack.e1[2][i] * pz;
+    if (det > -eps && det < eps) continue;
+
+    const float invDet = 1.0f / det;
+    const float bx = r.o[0] - pack.p0[0][i], by = r.o[1] - pack.p0[1][i], bz = r.o[2] - pack.p0[2][i];
+
+    u[i] = (bx * px + by * py + bz * pz) * invDet;
+    if (u[i] < 0 || u[i] > 1) continue;
+
+    const float qx = by * pack.e1[2][i] - bz * pack.e1[1][i];
+    const float qy = bz * pack.e1[0][i] - bx * pack.e1[2][i];
+    const float qz = bx * pack.e1[1][i] - by * pack.e1[0][i];
+
+    v[i] = (r.d[0] * qx + r.d[1] * qy + r.d[2] * qz) * invDet;
+    if (v[i] < 0 || u[i] + v[i] > 1) continue;
+
+    t[i] = (pack.e2[0][i] * qx + pack.e2[1][i] * qy + pack.e2[2][i] * qz) * invDet;
+    if (t[i] > tMin && t[i] < tMax) mask |= 1 << i;
+  }
+  return mask;
+#endif
+}
+
+// Returns the lanes hit in (tMin, tMax) with their distances written to t.
+// Same tests as Sphere::intersect (ray.d must be normalized).
+inline int intersectPack(const SpherePack &pack, const PackRay &r, float tMin, float tMax, float t[packWidth]) {
+#if defined(__SSE__)
+  // f = ray.o - c
+  const __m128 fx = _mm_sub_ps(_mm_set1_ps(r.o[0]), _mm_load_ps(pack.c[0]));
+  const __m128 fy = _mm_sub_ps(_mm_set1_ps(r.o[1]), _mm_load_ps(pack.c[1]));
+  const __m128 fz = _mm_sub_ps(_mm_set1_ps(r.o[2]), _mm_load_ps(pack.c[2]));
+  const __m128 dx = _mm_set1_ps(r.d[0]), dy = _mm_set1_ps(r.d[1]), dz = _mm_set1_ps(r.d[2]);
+  const __m128 r2 = _mm_load_ps(pack.r2);
+
+  const __m128 b = _mm_sub_ps(_mm_setzero_ps(),
+                              _mm_add_ps(_mm_add_ps(_mm_mul_ps(fx, dx), _mm_mul_ps(fy, dy)), _mm_mul_ps(fz, dz)));
+  const __m128 c = _mm_sub_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(fx, fx), _mm_mul_ps(fy, fy)), _mm_mul_ps(fz, fz)), r2);
+
+  const __m128 lx = _mm_add_ps(fx, _mm_mul_ps(dx, b));
+  const __m128 ly = _mm_add_ps(fy, _mm_mul_ps(dy, b));
+  const __m128 lz = _mm_add_ps(fz, _mm_mul_ps(dz, b));
+  const __m128 discrim = _mm_sub_ps(r2, _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)), _mm_mul_ps(lz, lz)));
+  const __m128 valid = _mm_cmpge_ps(discrim, _mm_setzero_ps());
+
+  // q = b + sign(b) * sqrt(discrim), sign(0) is -1 as in ver.hh
+  const __m128 sq = _mm_sqrt_ps(_mm_max_ps(discrim, _mm_setzero_ps()));
+  const __m128 positive = _mm_cmpgt_ps(b, _mm_setzero_ps());
+  const __m128 q = _mm_add_ps(b, _mm_or_ps(_mm_and_ps(positive, sq), _mm_andnot_ps(positive, _mm_sub_ps(_mm_setzero_ps(), sq))));
+
+  const __m128 ta = _mm_div_ps(c, q);
+  const __m128 t0 = _mm_min_ps(ta, q);
+  const __m128 t1 = _mm_max_ps(ta, q);
+
+  const __m128 lo = _mm_set1_ps(tMin), hi = _mm_set1_ps(tMax);
+  const __m128 useT0 = _mm_cmpgt_ps(t0, lo);
+  const __m128 tt = _mm_or_ps(_mm_and_ps(useT0, t0), _mm_andnot_ps(useT0, t1));
+
+  const __m128 mask = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(tt, lo), _mm_cmplt_ps(tt, hi)));
+
+  _mm_storeu_ps(t, tt);
+  return _mm_movemask_ps(mask);
+#else
+  int mask = 0;
+  for (int i = 0; i < packWidth; i++) {
+    const float fx = r.o[0] - pack.c[0][i], fy = r.o[1] - pack.c[1][i], fz = r.o[2] - pack.c[2][i];
+    const float b = -(fx * r.d[0] + fy * r.d[1] + fz * r.d[2]);
+    const float c = fx * fx + fy * fy + fz * fz - pack.r2[i];
+
+    const float lx = fx + r.d[0] * b, ly = fy + r.d[1] * b, lz = fz + r.d[2] * b;
+    const float discrim = pack.r2[i] - (lx * lx + ly * ly + lz * lz);
+    if (discrim < 0) continue;
+
+    const float q = b + sign(b) * std::sqrt(discrim);
+    const float t0 = std::min(c / q, q), t1 = std::max(c / q, q);
+
+    t[i] = (t0 > tMin) ? t0 : t1;
+    if (t[i] > tMin && t[i] < tMax) mask |= 1 << i;
+  }
+  return mask;
+#endif
+}
+
+// Replaces the primitive ranges of the leaves of nodes (as built by buildBVH
+// over primInfo) with ranges of packs, a leaf with nPrims primitives covers
+// (nPrims + packWidth - 1) / packWidth packs starting at its offset.
+// fill(pack, lane, primIdx) stores primitive primIdx in a lane of pack.
+template <typename Pack, typename Fill>
+std::vector<Pack> packLeaves(std::vector<LinearBVHNode> &nodes, const std::vector<BVHPrimitiveInfo> &primInfo,
+                             const Pack &empty, Fill &&fill) {
+  std::vector<uint> leaves;
+  uint nPacks = 0;
+  for (uint i = 0; i < nodes.size(); i++) {
+    if (nodes[i].nPrims == 0) continue;
+    leaves.push_back(i);
+    nPacks += (nodes[i].nPrims + packWidth - 1) / packWidth;
+  }
+
+  std::vector<Pack> packs(nPacks, empty);
+  std::vector<uint> firstPrim(leaves.size());
+
+  uint offset = 0;
+  for (size_t l = 0; l < leaves.size(); l++) {
+    LinearBVHNode &node = nodes[leaves[l]];
+    firstPrim[l] = node.offset;
+    node.offset = offset;
+    offset += (node.nPrims + packWidth - 1) / packWidth;
+  }
+
+  #pragma omp parallel for
+  for (size_t l = 0; l < leaves.size(); l++) {
+    const LinearBVHNode &node = nodes[leaves[l]];
+    for (uint i = 0; i < node.nPrims; i++)
+      fill(packs[node.offset + i / packWidth], i % packWidth, primInfo[firstPrim[l] + i].idx);
+  }
+
+  return packs;
+}
+
+#endif // PACKED_H_
@@ -0,0 +1,241 @@
+#include "wbvh.hh"
+
+namespace {
+  // Collapses the subtree of node into nodes, returns the index of its root
+  template <int N>
+  uint collapse(const std::vector<LinearBVHNode> &binary, uint node, std::vector<WideBVHNode<N>> &nodes) {
+    // Gather up to N children by repeatedly opening the largest interior one
+    uint children[N];
+    int n = 0;
+
+    if (binary[node].nPrims > 0) { // Leaf root
+      children[n++] = node;
+    } else {
+      children[n++] = node + 1;
+      children[n++] = binary[node].offset;
+    }
+
+    while (n < N) {
+      int best = -1;
+      Float bestArea = -1;
+      for (int i = 0; i < n; i++) {
+        const LinearBVHNode &child = binary[children[i]];
+        if (child.nPrims == 0 && child.bounds.surfaceArea() > bestArea) {
+          best = i;
+          bestArea = child.bounds.surfaceArea();
+        }
+      }
+      if (best < 0) break;
+
+      const uint c = children[best];
+      children[best] = c + 1;
+      children[n++] = binary[c].offset;
+    }
+
+    const uint idx = nodes.size();
+    nodes.emplace_back();
+
+    WideBVHNode<N> wide = WideBVHNode<N>(); // Zeroed padding keeps cache files reproducible
+    wide.nChildren = n;
+    for (int i = 0; i < N; i++) {
+      // Empty slots get inverted bounds so they never pass the slab test
+      const Bounds b = (i < n) ? binary[children[i]].bounds : Bounds();
+      for (int a = 0; a < 3; a++) {
+        // Float may be double, stored as float (the test is conservative anyway)
+        wide.lo[a][i] = static_cast<float>(b.min[a]);
+        wide.hi[a][i] = static_cast<float>(b.max[a]);
+      }
+      wide.offset[i] = 0;
+      wide.nPrims[i] = 0;
+    }
+
+    for (int i = 0; i < n; i++) {
+      const LinearBVHNode &child = binary[children[i]];
+      if (child.nPrims > 0) {
+        wide.offset[i] = child.offset;
+        wide.nPrims[i] = child.nPrims;
+      } else {
+        wide.offset[i] = collapse<N>(binary, children[i], nodes);
+      }
+    }
+
+    nodes[idx] = wide;
+    return idx;
+  }
+} // namespace
+
+template <int N>
+std::vector<WideBVHNode<N>> collapseBVH(const std::vector<LinearBVHNode> &binary) {
+  std::vector<WideBVHNode<N>> nodes;
+  if (binary.empty()) return nodes;
+  nodes.reserve(binary.size() / (N - 1) + 1);
+  collapse<N>(binary, 0, nodes);
+  return nodes;
+}
+
+template <int N>
+Bounds childBounds(const WideBVHNode<N> &node) {
+  Bounds b;
+  for (int c = 0; c < node.nChildren; c++)
+    b = b.Union(childBounds(node, c));
+  return b;
+}
+
+template <int N>
+Float wideBVHCost(const WideBVHNode<N> *nodes, size_t nNodes, const BVHConfig &config) {
+  if (nNodes == 0) return 0;
+
+  Float c = 0;
+  #pragma omp parallel for reduction(+:c)
+  for (size_t i = 0; i < nNodes; i++) {
+    c += config.traversalCost * childBounds(nodes[i]).surfaceArea();
+    for (int k = 0; k < nodes[i].nChildren; k++)
+      if (nodes[i].nPrims[k] > 0)
+        c += config.intersectionCost * leafTests(config, nodes[i].nPrims[k]) * childBounds(nodes[i], k).surfaceArea();
+  }
+
+  const Float rootArea = childBounds(nodes[0]).surfaceArea();
+  return (rootArea > 0) ? c / rootArea : 0;
+}
+
+template <int N>
+BVHStats bvhStats(const WideBVHNode<N> *nodes, size_t nNodes, const BVHConfig &config) {
+  BVHStats stats;
+  if (nNodes == 0) return stats;
+
+  std::vector<Bounds> leaves;
+  Float depthSum = 0;
+  std::vector<std::pair<uint, size_t>> stack = {{0, 0}}; // Node and its depth
+  while (!stack.empty()) {
+    const auto [i, depth] = stack.back();
+    stack.pop_back();
+
+    const WideBVHNode<N> &node = nodes[i];
+    for (int c = 0; c < node.nChildren; c++) {
+      if (node.nPrims[c] == 0) {
+        stack.push_back({node.offset[c], depth + 1});
+        continue;
+      }
+      leaves.push_back(childBounds(node, c));
+      depthSum += depth + 1;
+      stats.maxDepth = std::max(stats.maxDepth, depth + 1);
+      if (stats.leafSizes.size() <= node.nPrims[c]) stats.leafSizes.resize(node.nPrims[c] + 1, 0);
+      stats.leafSizes[node.nPrims[c]]++;
+    }
+  }
+
+  stats.nLeaves = leaves.size();
+  stats.nNodes = nNodes + stats.nLeaves;
+  stats.avgDepth = depthSum / stats.nLeaves;
+  stats.sahCost = wideBVHCost(nodes, nNodes, config);
+  stats.rootArea = childBounds(nodes[0]).surfaceArea();
+  stats.leafOverlap = leafOverlap(leaves);
+  stats.memory = nNodes * sizeof(WideBVHNode<N>);
+  return stats;
+}
+
+
+template <int N>
+WideBVH<N>::WideBVH(std::vector<std::shared_ptr<Primitive>> &&p, const BVHConfig &cfg)
+  : Aggregate(cfg), primitives{std::move(p)}, nodes{}, worldBounds{} {
+  config.maxPrimsInNode = std::min((size_t)255, std::max((size_t)1, config.maxPrimsInNode));
+  rebuild();
+}
+
+template <int N>
+void WideBVH<N>::rebuild() {
+  nodes.clear();
+  worldBounds = Bounds();
+  builtCost = 0;
+  if (primitives.empty()) return;
+
+  const std::vector<LinearBVHNode> binary = buildAggregateBVH(primitives, config);
+  worldBounds = binary[0].bounds;
+
+  nodes = collapseBVH<N>(binary);
+  builtCost = cost();
+}
+
+template <int N>
+void WideBVH<N>::refit() {
+  if (nodes.empty()) return;
+
+  // collapse stores children after their parent, so the tree is refitted
+  // level by level from the deepest one up
+  const auto levels = nodeLevels(nodes.size(), [&](uint i, auto &&visit) {
+    for (int c = 0; c < nodes[i].nChildren; c++)
+      if (nodes[i].nPrims[c] == 0) visit(nodes[i].offset[c]);
+  });
+
+  for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+    #pragma omp parallel for if (level->size() > 256)
+    for (size_t k = 0; k < level->size(); k++) {
+      WideBVHNode<N> &node = nodes[(*level)[k]];
+      for (int c = 0; c < node.nChildren; c++) {
+        Bounds b;
+        if (node.nPrims[c] > 0) {
+          for (uint j = 0; j < node.nPrims[c]; j++)
+            b = b.Union(primitives[node.offset[c] + j]->bounds());
+        } else {
+          b = childBounds(nodes[node.offset[c]]);
+        }
+        for (int a = 0; a < 3; a++) {
+          node.lo[a][c] = static_cast<float>(b.min[a]);
+          node.hi[a][c] = static_cast<float>(b.max[a]);
+        }
+      }
+    }
+  }
+
+  worldBounds = childBounds(nodes[0]);
+}
+
+template <int N>
+Float WideBVH<N>::cost() const { return wideBVHCost(nodes.data(), nodes.size(), config); }
+
+template <int N>
+BVHStats WideBVH<N>::stats() const {
+  BVHStats stats = bvhStats(nodes.data(), nodes.size(), config);
+  stats.memory += primitives.size() * sizeof(std::shared_ptr<Primitive>);
+  return stats;
+}
+
+template <int N>
+Bounds WideBVH<N>::bounds() const { return worldBounds; }
+
+template <int N>
+bool WideBVH<N>::intersect(const Ray &ray, HitRecord &hit) const {
+  return traverseBVH<false>(nodes.data(), nodes.size(), ray, [&](uint offset, uint nPrims) {
+    bool leafHit = false;
+    for (uint j = 0; j < nPrims; j++)
+      if (primitives[offset + j]->intersect(ray, hit))
+        leafHit = true;
+    return leafHit;
+  });
+}
+
+template <int N>
+bool WideBVH<N>::intersectP(const Ray &ray) const {
+  return traverseBVH<true>(nodes.data(), nodes.size(), ray, [&](uint offset, uint nPrims) {
+    for (uint j = 0; j < nPrims; j++)
+      if (primitives[offset + j]->intersectP(ray))
+        return true;
+    return false;
+  });
+}
+
+template <int N>
+void WideBVH<N>::interaction(const Ray &ray, const HitRecord &hit, SurfaceInteraction &interact) const {
+  hit.primitive->interaction(ray, hit, interact); // The primitive hit inside the BVH
+}
+
+template std::vector<WideBVHNode<4>> collapseBVH<4>(const std::vector<LinearBVHNode> &binary);
+template std::vector<WideBVHNode<8>> collapseBVH<8>(const std::vector<LinearBVHNode> &binary);
+template Bounds childBounds<4>(const WideBVHNode<4> &node);
+template Bounds childBounds<8>(const WideBVHNode<8> &node);
+template Float wideBVHCost<4>(const WideBVHNode<4> *nodes, size_t nNodes, const BVHConfig &config);
+template Float wideBVHCost<8>(const WideBVHNode<8> *nodes, size_t nNodes, const BVHConfig &config);
+template BVHStats bvhStats<4>(const WideBVHNode<4> *nodes, size_t nNodes, const BVHConfig &config);
+template BVHStats bvhStats<8>(const WideBVHNode<8> *nodes, size_t nNodes, const BVHConfig &config);
+template class WideBVH<4>;
+template class WideBVH<8>;
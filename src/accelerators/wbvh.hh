@@ -0,0 +1,284 @@
+#ifndef WBVH_H_
+#define WBVH_H_
+
+#include "ver.hh"
+#include "accelerators/bvh.hh"
+#include "packet.hh"
+
+#if defined(__SSE__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// N-wide BVH node, children bounds are stored in SoA layout so that all of
+// them can be tested against a ray with a single SIMD slab test
+template <int N>
+struct alignas(4 * N) WideBVHNode {
+  float lo[3][N], hi[3][N];
+  uint32_t offset[N]; // Child node index, or first primitive if it is a leaf
+  uint8_t nPrims[N];  // 0 if the child is an interior node
+  uint8_t nChildren;
+};
+
+// Collapses a tree built by buildBVH or buildSBVH into N-wide nodes, children
+// come after their parent. Leaves keep their offset and nPrims, which must
+// fit in a uint8_t (buildBVH leaves always do).
+template <int N>
+std::vector<WideBVHNode<N>> collapseBVH(const std::vector<LinearBVHNode> &binary);
+
+// Union of the bounds of all the children of node
+template <int N>
+Bounds childBounds(const WideBVHNode<N> &node);
+
+// SAH cost of a wide tree relative to its root, as Aggregate::cost
+template <int N>
+Float wideBVHCost(const WideBVHNode<N> *nodes, size_t nNodes, const BVHConfig &config);
+
+// Statistics of a wide tree, leaves are stored in the slots of their parents
+// and count as nodes. As the binary version, memory only counts the nodes.
+template <int N>
+BVHStats bvhStats(const WideBVHNode<N> *nodes, size_t nNodes, const BVHConfig &config);
+
+// Ray data needed by the slab tests, precomputed once per traversal
+struct WideRay {
+  explicit WideRay(const Ray &ray) {
+    for (int a = 0; a < 3; a++) {
+      o[a] = ray.o[a];
+      invDir[a] = 1.0f / static_cast<float>(ray.d[a]);
+      dirIsNeg[a] = invDir[a] < 0;
+    }
+  }
+
+  float o[3], invDir[3];
+  int dirIsNeg[3];
+};
+
+// Returns a bitmask with the children of node hit by the ray in [tMin, tMax],
+// their entry distances are written to tNear
+template <int N>
+inline int intersectChildren(const WideBVHNode<N> &node, const WideRay &r, float tMin, float tMax, float tNear[N]) {
+  constexpr float robust = 1 + 2 * gamma(3); // Conservative tFar, see Bounds::intersect
+  int mask = 0;
+  for (int i = 0; i < node.nChildren; i++) {
+    float t0 = tMin, t1 = tMax;
+    for (int a = 0; a < 3; a++) {
+      const float near = r.dirIsNeg[a] ? node.hi[a][i] : node.lo[a][i];
+      const float far = r.dirIsNeg[a] ? node.lo[a][i] : node.hi[a][i];
+      const float tn = (near - r.o[a]) * r.invDir[a];
+      const float tf = (far - r.o[a]) * r.invDir[a] * robust;
+      t0 = tn > t0 ? tn : t0;
+      t1 = tf < t1 ? tf : t1;
+    }
+    tNear[i] = t0;
+    if (t0 <= t1) mask |= 1 << i;
+  }
+  return mask;
+}
+
+#if defined(__SSE__)
+template <>
+inline int intersectChildren<4>(const WideBVHNode<4> &node, const WideRay &r, float tMin, float tMax, float tNear[4]) {
+  constexpr float robust = 1 + 2 * gamma(3);
+  __m128 t0 = _mm_set1_ps(tMin);
+  __m128 t1 = _mm_set1_ps(tMax);
+  const __m128 rob = _mm_set1_ps(robust);
+
+  for (int a = 0; a < 3; a++) {
+    const __m128 o = _mm_set1_ps(r.o[a]);
+    const __m128 inv = _mm_set1_ps(r.invDir[a]);
+    const __m128 near = _mm_loadu_ps(r.dirIsNeg[a] ? node.hi[a] : node.lo[a]);
+    const __m128 far = _mm_loadu_ps(r.dirIsNeg[a] ? node.lo[a] : node.hi[a]);
+
+    const __m128 tn = _mm_mul_ps(_mm_sub_ps(near, o), inv);
+    const __m128 tf = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(far, o), inv), rob);
+
+    // Operand order matters: NaNs (0 * inf) leave t0/t1 untouched
+    t0 = _mm_max_ps(tn, t0);
+    t1 = _mm_min_ps(tf, t1);
+  }
+
+  _mm_storeu_ps(tNear, t0);
+  return _mm_movemask_ps(_mm_cmple_ps(t0, t1)) & ((1 << node.nChildren) - 1);
+}
+#endif
+
+#if defined(__AVX__)
+template <>
+inline int intersectChildren<8>(const WideBVHNode<8> &node, const WideRay &r, float tMin, float tMax, float tNear[8]) {
+  constexpr float robust = 1 + 2 * gamma(3);
+  __m256 t0 = _mm256_set1_ps(tMin);
+  __m256 t1 = _mm256_set1_ps(tMax);
+  const __m256 rob = _mm256_set1_ps(robust);
+
+  for (int a = 0; a < 3; a++) {
+    const __m256 o = _mm256_set1_ps(r.o[a]);
+    const __m256 inv = _mm256_set1_ps(r.invDir[a]);
+    const __m256 near = _mm256_loadu_ps(r.dirIsNeg[a] ? node.hi[a] : node.lo[a]);
+    const __m256 far = _mm256_loadu_ps(r.dirIsNeg[a] ? node.lo[a] : node.hi[a]);
+
+    const __m256 tn = _mm256_mul_ps(_mm256_sub_ps(near, o), inv);
+    const __m256 tf = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(far, o), inv), rob);
+
+    // Operand order matters: NaNs (0 * inf) leave t0/t1 untouched
+    t0 = _mm256_max_ps(tn, t0);
+    t1 = _mm256_min_ps(tf, t1);
+  }
+
+  _mm256_storeu_ps(tNear, t0);
+  return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ)) & ((1 << node.nChildren) - 1);
+}
+#endif
+
+// Bounds of child c of a wide node
+template <int N>
+inline Bounds childBounds(const WideBVHNode<N> &node, int c) {
+  return Bounds(Point(node.lo[0][c], node.lo[1][c], node.lo[2][c]),
+                Point(node.hi[0][c], node.hi[1][c], node.hi[2][c]));
+}
+
+// Wide version of traverseBVH, same contract for intersectLeaf. Closest-hit
+// queries visit the interior children front to back and skip the ones that
+// start past the closest hit so far.
+template <bool AnyHit, int N, typename IntersectLeaf>
+bool traverseBVH(const WideBVHNode<N> *nodes, size_t nNodes, const Ray &ray, IntersectLeaf &&intersectLeaf) {
+  if (nNodes == 0) return false;
+  bool hit = false;
+  const WideRay r(ray);
+
+  struct StackEntry {
+    uint node;
+    float tNear;
+  };
+  StackEntry nodesToVisit[64 * N];
+  uint toVisitOffset = 0;
+  nodesToVisit[toVisitOffset++] = {0, static_cast<float>(ray.tMin)};
+
+  while (toVisitOffset > 0) {
+    const StackEntry entry = nodesToVisit[--toVisitOffset];
+    if (!AnyHit && entry.tNear > ray.tMax) continue; // Behind the closest hit
+
+    const WideBVHNode<N> &node = nodes[entry.node];
+
+    float tNear[N];
+    const int mask = intersectChildren<N>(node, r, ray.tMin, ray.tMax, tNear);
+
+    // Leaves are tested right away, interior children sorted front to back
+    // (any hit will do for AnyHit, so there they are not sorted)
+    int order[N];
+    int nInterior = 0;
+    for (int i = 0; i < N; i++) {
+      if (!(mask & (1 << i))) continue;
+
+      if (node.nPrims[i] > 0) {
+        if (intersectLeaf(node.offset[i], node.nPrims[i])) {
+          if (AnyHit) return true;
+          hit = true;
+        }
+      } else {
+        int k = nInterior++;
+        if (!AnyHit)
+          for (; k > 0 && tNear[order[k - 1]] < tNear[i]; k--)
+            order[k] = order[k - 1];
+        order[k] = i;
+      }
+    }
+
+    // order is sorted far to near, so the nearest child is popped first
+    for (int k = 0; k < nInterior; k++)
+      nodesToVisit[toVisitOffset++] = {node.offset[order[k]], tNear[order[k]]};
+  }
+  return hit;
+}
+
+// Wide version of traverseBVHPacket: every child is tested against the
+// lanes that reached its parent
+template <int N, typename IntersectLeaf>
+void traverseBVHPacket(const WideBVHNode<N> *nodes, size_t nNodes, RayPacket &packet, uint32_t lanes,
+                       IntersectLeaf &&intersectLeaf) {
+  if (nNodes == 0 || lanes == 0) return;
+
+  struct Entry {
+    uint node;
+    uint32_t lanes;
+  };
+  Entry toVisit[64 * N];
+  uint toVisitOffset = 0;
+  toVisit[toVisitOffset++] = {0, lanes};
+
+  while (toVisitOffset > 0) {
+    const Entry entry = toVisit[--toVisitOffset];
+    const WideBVHNode<N> &node = nodes[entry.node];
+
+    for (int i = node.nChildren - 1; i >= 0; i--) {
+      const uint32_t active = packet.intersect(childBounds(node, i), entry.lanes);
+      if (active == 0) continue;
+
+      if (node.nPrims[i] > 0)
+        intersectLeaf(node.offset[i], node.nPrims[i], active);
+      else
+        toVisit[toVisitOffset++] = {node.offset[i], active};
+    }
+  }
+}
+
+// Wide version of traverseBVHPacketP, returns all the blocked lanes
+template <int N, typename IntersectLeaf>
+uint32_t traverseBVHPacketP(const WideBVHNode<N> *nodes, size_t nNodes, const RayPacket &packet, uint32_t lanes,
+                            IntersectLeaf &&intersectLeaf) {
+  if (nNodes == 0 || lanes == 0) return 0;
+
+  struct Entry {
+    uint node;
+    uint32_t lanes;
+  };
+  Entry toVisit[64 * N];
+  uint toVisitOffset = 0;
+  toVisit[toVisitOffset++] = {0, lanes};
+
+  uint32_t blocked = 0;
+  while (toVisitOffset > 0) {
+    const Entry entry = toVisit[--toVisitOffset];
+    const WideBVHNode<N> &node = nodes[entry.node];
+
+    for (int i = 0; i < node.nChildren; i++) {
+      const uint32_t active = packet.intersect(childBounds(node, i), entry.lanes & ~blocked);
+      if (active == 0) continue;
+
+      if (node.nPrims[i] > 0) {
+        blocked |= intersectLeaf(node.offset[i], node.nPrims[i], active);
+        if (blocked == lanes) return blocked;
+      } else {
+        toVisit[toVisitOffset++] = {node.offset[i], active};
+      }
+    }
+  }
+  return blocked;
+}
+
+// BVH collapsed from a binary one (built with buildAggregateBVH) into N-wide nodes
+template <int N>
+class WideBVH : public Aggregate {
+  static_assert(N == 4 || N == 8, "Only 4 and 8 wide BVHs are supported");
+
+  public:
+    WideBVH(std::vector<std::shared_ptr<Primitive>> &&p, const BVHConfig &cfg = BVHConfig());
+    void refit() override;
+    void rebuild() override;
+    Float cost() const override;
+    BVHStats stats() const override;
+
+    Bounds bounds() const override;
+    bool intersect(const Ray &ray, HitRecord &hit) const override;
+    bool intersectP(const Ray &ray) const override;
+    void interaction(const Ray &ray, const HitRecord &hit,
+                     SurfaceInteraction &interact) const override;
+
+  private:
+    std::vector<std::shared_ptr<Primitive>> primitives;
+    std::vector<WideBVHNode<N>> nodes;
+    Bounds worldBounds;
+};
+
+using BVH4 = WideBVH<4>;
+using BVH8 = WideBVH<8>;
+
+#endif // WBVH_H_
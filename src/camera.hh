@@ -2,7 +2,10 @@
 #define CAMERA_H_
 
 #include "image/film.hh"
+#include "image/variance.hh"
 #include "geometry.hh"
+#include "packet.hh"
+#include "sampler.hh"
 #include "ver.hh"
 
 class Camera {
@@ -14,6 +17,8 @@ class Camera {
       : film(width, height, color_res),
         nFilm(width, height, color_res),
         dFilm(width, height, color_res),
+        sFilm(width, height, color_res),
+        variance(width, height),
         eye(eye_), left(left_), up(up_), forward(forward_),
         aspectRatio(static_cast<Float>(width) / static_cast<Float>(height)),
         delta_u(2.0 / static_cast<Float>(width)), delta_v(2.0 / static_cast<Float>(height)) {
@@ -41,7 +46,21 @@ class Camera {
                (lookAt - eye_).normalize() * focalLength, color_res
                ) {}
     
-    virtual Ray getRay(size_t x, size_t y, uint seed = 5489u) const = 0;
+    // The jitter inside the pixel is the next 2D sample, samples must have
+    // been started at the sample of the pixel
+    virtual Ray getRay(size_t x, size_t y, Sampler &samples) const = 0;
+
+    // Sample index of the w x h (at most packetSize) pixels starting at x, y.
+    // Lane i holds pixel (x + i % w, y + i / w).
+    RayPacket getRays(size_t x, size_t y, size_t w, size_t h, Sampler &samples, uint64_t index) const {
+      assert(w * h <= packetSize, "Too many pixels for a packet");
+      RayPacket packet;
+      for (size_t i = 0; i < w * h; i++) {
+        samples.start((y + i / w) * film.getWidth() + x + i % w, index);
+        packet.set(i, getRay(x + i % w, y + i / w, samples));
+      }
+      return packet;
+    }
 
     virtual void writeColor(size_t x, size_t y, const Direction &color) {
       assert(y < film.getWidth(), "x < width");
@@ -88,9 +107,25 @@ class Camera {
       px.b = depth;
     }
 
+    // Samples taken for the pixel, for the sample count AOV
+    virtual void writeSamples(size_t x, size_t y, size_t samples) {
+      assert(x < film.getWidth(), "x < width");
+      assert(y <= film.getHeight(), "y < height");
+
+      const size_t idx = y * film.getHeight() * aspectRatio + x;
+
+      image::Pixel &px = sFilm[idx];
+
+      px.r = samples;
+      px.g = samples;
+      px.b = samples;
+    }
+
   public: // Portected
     image::Film film;
     image::Film nFilm, dFilm; // normal and depth
+    image::Film sFilm; // samples per pixel
+    image::VarianceBuffer variance; // Of the samples of film, adaptive sampling
 
     Point eye;
     Direction left, up, forward;
@@ -103,13 +138,14 @@ class PinholeCamera : public Camera {
   public:
     using Camera::Camera;
 
-    Ray getRay(size_t x, size_t y, uint seed) const override {
+    Ray getRay(size_t x, size_t y, Sampler &samples) const override {
       assert(x <= film.getWidth(), "x < width");
       assert(y <= film.getHeight(), "y < height");
 
       // Add a random number to the pixel to avoid aliasing
-      const Float su = uniform(0, delta_u, seed);
-      const Float sv = uniform(0, delta_v, seed);
+      const Vec2 jitter = samples.get2D();
+      const Float su = jitter.x * delta_u;
+      const Float sv = jitter.y * delta_v;
 
       // 0, 0 is the top left corner
       const Float u = x / static_cast<Float>(film.getWidth()) + su;
@@ -125,13 +161,14 @@ class OrthographicCamera : public Camera {
   public:
     using Camera::Camera;
 
-    Ray getRay(size_t x, size_t y, uint seed) const override {
+    Ray getRay(size_t x, size_t y, Sampler &samples) const override {
       assert(x <= film.getWidth(), "x < width");
       assert(y <= film.getHeight(), "y < height");
 
       // Add a random number to the pixel to avoid aliasing
-      const Float su = uniform(0, delta_u, seed);
-      const Float sv = uniform(0, delta_v, seed);
+      const Vec2 jitter = samples.get2D();
+      const Float su = jitter.x * delta_u;
+      const Float sv = jitter.y * delta_v;
 
       // 0, 0 is the top left corner
       const Float u = x / static_cast<Float>(film.getWidth()) + su;
@@ -252,7 +252,7 @@ class Mat4 {
     }
     [[nodiscard]] static Mat4 scale(const Direction &scaling) { return Mat4::scale(scaling.x, scaling.y, scaling.z); }
     [[nodiscard]] static Mat4 rotate(Float theta, const Direction &axis) {
-      Mat4 mat;
+      Mat4 mat = Mat4::identity();
 
       Direction a = axis.normalize();
       Float sinTheta = std::sin(theta);
@@ -314,6 +314,14 @@ class Mat4 {
       return Direction(out[0], out[1], out[2]);
     }
 
+    [[nodiscard]] Mat4 transpose() const {
+      Mat4 res;
+      for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+          res.data[i*4 + j] = data[j*4 + i];
+      return res;
+    }
+
     [[nodiscard]] Mat4 invert() const {
       Mat4 inv;
       //if (data[3*4 + 0]==0 && data[3*4 + 1]==0 && data[3*4 + 2]==0 && data[3*4 + 3]==1) {
@@ -411,19 +419,25 @@ class Ray {
   public:
     bool hasNaNs() const { return o.hasNaNs() || d.hasNaNs(); }
 
-    Ray(const Point &origin, const Direction &direction) : o{origin}, d{direction.normalize()} { assert(!hasNaNs(), "Has NaNs"); }
+    Ray() : Ray(Point(0, 0, 0), Direction(0, 0, 1)) {}
+    Ray(const Point &origin, const Direction &direction,
+        Float tMin_ = 0, Float tMax_ = std::numeric_limits<Float>::infinity())
+      : o{origin}, d{direction.normalize()}, tMin{tMin_}, tMax{tMax_} { assert(!hasNaNs(), "Has NaNs"); }
 
     [[nodiscard]] Point operator()(Float t) const { return o + d * t; }
 
     friend std::ostream &operator <<(std::ostream &os, const Ray &ray) {
-      os << "Ray(" << ray.o << ", " << ray.d << ")";
+      os << "Ray(" << ray.o << ", " << ray.d << ", [" << ray.tMin << ", " << ray.tMax << "])";
       return os;
     }
 
   public:
     Point o;
     Direction d;
-    // Float tMax; // TODO
+    // Valid interval of the ray, tMin avoids self-intersections and tMax is
+    // shrunk by the intersection routines to the closest hit found so far
+    Float tMin;
+    mutable Float tMax;
     // Medium medium; // TODO
 };
 
@@ -538,7 +552,7 @@ class Bounds {
     }
 
     [[nodiscard]] bool intersect(const Ray &ray, Float &t0, Float &t1) const {
-      t0 = 0; t1 = std::numeric_limits<Float>::max();
+      t0 = ray.tMin; t1 = ray.tMax;
       for (int i = 0; i < 3; i++) {
         Float invRayDir = 1.0 / ray.d[i];
         Float tNear = (min[i] - ray.o[i]) * invRayDir;
@@ -555,7 +569,6 @@ class Bounds {
     }
 
     [[nodiscard]] bool intersect(const Ray &ray, const Direction &invDir, const int dirIsNeg[3]) const {
-      const Float raytMax = std::numeric_limits<Float>::max();
       const Bounds &bounds = *this;
 
       Float tMin = (bounds[dirIsNeg[0]].x - ray.o.x) * invDir.x;
@@ -577,7 +590,7 @@ class Bounds {
       if (tzMin > tMin) tMin = tzMin;
       if (tzMax < tMax) tMax = tzMax;
 
-      return (tMin < raytMax) && (tMax > 0);
+      return (tMin < ray.tMax) && (tMax > ray.tMin);
     }
 
     friend std::ostream &operator <<(std::ostream &os, const Bounds &b) {
@@ -0,0 +1,168 @@
+#include "accumulation.hh"
+#include "../utils/mapped.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+
+namespace image {
+  namespace {
+    // Files start with this header, followed by the sums, counts, normals
+    // and depths of every pixel in that order
+    struct Header {
+      char magic[8];
+      uint64_t key;
+      uint64_t width, height;
+      uint64_t floatSize; // Files are only read back on the same build
+      uint64_t spp;
+      uint32_t shard, shards;
+      uint32_t partition;
+      uint32_t padding;
+    };
+
+    const char magic[8] = {'V', 'E', 'R', 'A', 'C', 'C', '0', '2'};
+
+    static_assert(std::is_trivially_copyable<Spectrum>::value, "Sums are stored as raw bytes");
+    static_assert(sizeof(Header) % alignof(Spectrum) == 0, "Sections are read in place");
+
+    size_t pixelSize() { return sizeof(Spectrum) + sizeof(uint32_t) + sizeof(Direction) + sizeof(Float); }
+
+    // Header of a mapped accumulation file, throws if it is not one
+    Header header(const utils::MappedFile &file, const std::string &filename) {
+      Header h;
+      if (file.size() < sizeof(Header))
+        throw std::runtime_error(filename + " is not a render accumulation");
+      std::memcpy(&h, file.data(), sizeof(Header));
+      if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.floatSize != sizeof(Float))
+        throw std::runtime_error(filename + " is not a render accumulation");
+      if (file.size() != sizeof(Header) + h.width * h.height * pixelSize())
+        throw std::runtime_error(filename + " is truncated");
+      return h;
+    }
+
+    // Sections of a mapped accumulation file, read in place
+    struct Sections {
+      Sections(const utils::MappedFile &file, size_t n)
+        : sum{reinterpret_cast<const Spectrum *>(file.data() + sizeof(Header))},
+          count{reinterpret_cast<const uint32_t *>(sum + n)},
+          normal{reinterpret_cast<const Direction *>(count + n)},
+          depth{reinterpret_cast<const Float *>(normal + n)} {}
+
+      const Spectrum *sum;
+      const uint32_t *count;
+      const Direction *normal;
+      const Float *depth;
+    };
+  }
+
+  Accumulation::Accumulation(size_t width_, size_t height_)
+    : width{width_}, height{height_}, sum(width * height), count(width * height, 0),
+      normal(width * height, Direction(0, 0, 0)), depth(width * height, 0) {}
+
+  void save(const std::string &filename, const Accumulation &acc, uint64_t key) {
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.key = key;
+    header.width = acc.width;
+    header.height = acc.height;
+    header.floatSize = sizeof(Float);
+    header.spp = acc.spp;
+    header.shard = acc.shard.index;
+    header.shards = acc.shard.count;
+    header.partition = static_cast<uint32_t>(acc.shard.partition);
+
+    const size_t n = acc.width * acc.height;
+    const std::string tmp = filename + ".tmp";
+    {
+      std::ofstream file(tmp, std::ofstream::binary | std::ofstream::trunc);
+      file.write(reinterpret_cast<const char *>(&header), sizeof(Header));
+      file.write(reinterpret_cast<const char *>(acc.sum.data()), n * sizeof(Spectrum));
+      file.write(reinterpret_cast<const char *>(acc.count.data()), n * sizeof(uint32_t));
+      file.write(reinterpret_cast<const char *>(acc.normal.data()), n * sizeof(Direction));
+      file.write(reinterpret_cast<const char *>(acc.depth.data()), n * sizeof(Float));
+      file.flush();
+      if (!file) throw std::runtime_error("Could not write " + tmp);
+    }
+    std::filesystem::rename(tmp, filename);
+  }
+
+  Accumulation load(const std::string &filename, uint64_t key) {
+    const utils::MappedFile file(filename);
+    const Header h = header(file, filename);
+    if (h.key != key)
+      throw std::runtime_error(filename + " belongs to another render (scene, size or render parameters differ)");
+
+    Accumulation acc;
+    acc.width = h.width;
+    acc.height = h.height;
+    acc.spp = h.spp;
+    acc.shard.index = h.shard;
+    acc.shard.count = h.shards;
+    acc.shard.partition = static_cast<ShardPartition>(h.partition);
+
+    const size_t n = acc.width * acc.height;
+    const Sections sections(file, n);
+    acc.sum.assign(sections.sum, sections.sum + n);
+    acc.count.assign(sections.count, sections.count + n);
+    acc.normal.assign(sections.normal, sections.normal + n);
+    acc.depth.assign(sections.depth, sections.depth + n);
+    return acc;
+  }
+
+  bool isAccumulation(const std::string &filename) {
+    char start[sizeof(magic)] = {};
+    std::ifstream file(filename, std::ifstream::binary);
+    file.read(start, sizeof(start));
+    return file && std::memcmp(start, magic, sizeof(magic)) == 0;
+  }
+
+  Accumulation merge(const std::vector<std::string> &filenames) {
+    Accumulation acc;
+    Header first{};
+    std::vector<bool> seen;
+
+    for (const std::string &filename : filenames) {
+      std::cout << "Merging " << filename << std::endl;
+      const utils::MappedFile file(filename);
+      const Header h = header(file, filename);
+
+      if (seen.empty()) {
+        first = h;
+        acc = Accumulation(h.width, h.height);
+        acc.shard.partition = static_cast<ShardPartition>(h.partition);
+        seen.assign(h.shards, false);
+      } else if (h.key != first.key || h.shards != first.shards || h.partition != first.partition) {
+        throw std::runtime_error(filename + " is not a shard of the same render as " + filenames[0]);
+      }
+      if (h.shard >= h.shards || seen[h.shard])
+        throw std::runtime_error(filename + ": shard " + std::to_string(h.shard) + " of " + std::to_string(h.shards) + " comes twice");
+      seen[h.shard] = true;
+      acc.spp = std::max<size_t>(acc.spp, h.spp);
+
+      // AOVs come from the first shard with samples of the pixel
+      const Sections sections(file, acc.width * acc.height);
+      #pragma omp parallel for schedule(static, 4096)
+      for (size_t i = 0; i < acc.width * acc.height; i++) {
+        if (sections.count[i] == 0) continue;
+        if (acc.count[i] == 0) {
+          acc.normal[i] = sections.normal[i];
+          acc.depth[i] = sections.depth[i];
+        }
+        acc.sum[i] += sections.sum[i];
+        acc.count[i] += sections.count[i];
+      }
+    }
+
+    std::string missing;
+    for (size_t i = 0; i < seen.size(); i++)
+      if (!seen[i]) missing += (missing.empty() ? "" : ", ") + std::to_string(i);
+    if (!missing.empty())
+      std::cerr << "Warning: shards " << missing << " of " << seen.size() << " are missing" << std::endl;
+
+    return acc;
+  }
+}
@@ -0,0 +1,59 @@
+#ifndef ACCUMULATION_H_
+#define ACCUMULATION_H_
+
+#include "ver.hh"
+#include "spectrum.hh"
+#include <string>
+#include <vector>
+
+namespace image {
+  // How a render is split between processes: by sample index (shard i of N
+  // takes samples i, i + N, i + 2N, ... of every pixel) or by tiles (tiles
+  // i, i + N, ... in the order of the tile scheduler, with every sample)
+  enum class ShardPartition { Samples, Tiles };
+
+  struct Shard {
+    uint32_t index = 0;
+    uint32_t count = 1;
+    ShardPartition partition = ShardPartition::Samples;
+
+    bool operator==(const Shard &shard) const { return index == shard.index && count == shard.count && partition == shard.partition; }
+  };
+
+  // What a render has accumulated so far, per pixel: the sum of its radiance
+  // samples, how many there are and the primary hit AOVs. The image is
+  // sum / count, so accumulations of the same render can be carried on or
+  // added up without losing anything.
+  struct Accumulation {
+    Accumulation() = default;
+    Accumulation(size_t width_, size_t height_);
+
+    size_t width = 0, height = 0;
+    size_t spp = 0;      // Target of the render, the counts say how far it got
+    Shard shard;         // Part of the render the samples belong to
+    std::vector<Spectrum> sum;
+    std::vector<uint32_t> count;
+    std::vector<Direction> normal;
+    std::vector<Float> depth;
+  };
+
+  // Binary file of an accumulation. key identifies the render it belongs to
+  // (scene and parameters), a file is only loaded back with the same key.
+  // The file is written next to filename and renamed, so an interrupted
+  // write never leaves a truncated file behind.
+  void save(const std::string &filename, const Accumulation &acc, uint64_t key);
+  // Throws if the file is not an accumulation of the render given by key
+  Accumulation load(const std::string &filename, uint64_t key);
+
+  // Whether the file starts like an accumulation, to tell them from images
+  bool isAccumulation(const std::string &filename);
+
+  // Adds up the shards of a render, whatever the samples each one took: the
+  // result is the accumulation of their union. Files are added one at a
+  // time straight from their mapping, pixels in parallel, so only one
+  // accumulation is ever in memory. Throws if the files belong to different
+  // renders or a shard comes twice, warns about missing shards.
+  Accumulation merge(const std::vector<std::string> &filenames);
+}
+
+#endif // ACCUMULATION_H_
@@ -0,0 +1,29 @@
+#include "variance.hh"
+#include <cmath>
+#include <limits>
+
+namespace image {
+  VarianceBuffer::VarianceBuffer(size_t width, size_t height)
+    : n(width * height, 0), mu(width * height), lum(width * height, 0), m2(width * height, 0) {}
+
+  void VarianceBuffer::add(size_t idx, const Pixel &sample) {
+    n[idx]++;
+    const Float inv = 1.0 / n[idx];
+    mu[idx].r += (sample.r - mu[idx].r) * inv;
+    mu[idx].g += (sample.g - mu[idx].g) * inv;
+    mu[idx].b += (sample.b - mu[idx].b) * inv;
+
+    const Float y = sample.luminance();
+    const Float delta = y - lum[idx];
+    lum[idx] += delta * inv;
+    m2[idx] += delta * (y - lum[idx]);
+  }
+
+  Float VarianceBuffer::relativeError(size_t idx) const {
+    // Keeps black pixels from asking for samples forever over float noise
+    constexpr Float minLuminance = 1e-3;
+
+    if (n[idx] < 2) return std::numeric_limits<Float>::infinity();
+    return std::sqrt(variance(idx) / n[idx]) / std::max(lum[idx], minLuminance);
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef VARIANCE_H_
+#define VARIANCE_H_
+
+#include "framebuffer.hh"
+#include <vector>
+
+namespace image {
+  // Running mean of the samples of every pixel and variance of their
+  // luminance (Welford's algorithm), kept next to a Film to decide which
+  // pixels need more samples
+  class VarianceBuffer {
+    public:
+      VarianceBuffer(size_t width, size_t height);
+
+      void add(size_t idx, const Pixel &sample);
+
+      size_t samples(size_t idx) const { return n[idx]; }
+      Pixel mean(size_t idx) const { return mu[idx]; }
+      // Sample variance of the luminance, 0 with less than two samples
+      Float variance(size_t idx) const { return (n[idx] > 1) ? m2[idx] / (n[idx] - 1) : 0; }
+      // Standard error of the mean luminance relative to the mean luminance,
+      // infinite with less than two samples
+      Float relativeError(size_t idx) const;
+
+    private:
+      std::vector<uint32_t> n;
+      std::vector<Pixel> mu;
+      std::vector<Float> lum; // Mean luminance
+      std::vector<Float> m2;  // Sum of squared differences to lum
+  };
+}
+
+#endif // VARIANCE_H_
@@ -1,84 +1,519 @@
 #include "pathtracer.hh"
+#include <atomic>
 #include <chrono>
+#include <csignal>
+#include <filesystem>
+#include <iomanip>
 #include "geometry.hh"
+#include "../utils/mapped.hh"
 #include "../utils/time.hh"
-#include "../utils/lwpb.hh"
+#include "../utils/telemetry.hh"
 
 namespace pathtracer {
-  Spectrum Li(const Ray &r, const Scene &scene, size_t depth, HemisphereSampler sampler) {
-    constexpr Float eps = 1e-4; // Self-shadow eps
+  bool RussianRoulette::survives(size_t bounces, Spectrum &beta, Sampler &samples) const {
+    if (threshold <= 0 || bounces < minDepth) return true;
+
+    const Float survival = beta.max();
+    if (survival >= threshold) return true;
+
+    const Float q = std::max(minSurvival, survival);
+    if (samples.get1D() >= q) return false;
+
+    beta /= q;
+    return true;
+  }
 
+  Spectrum Li(const Ray &r, const Scene &scene, size_t depth, HemisphereSampler sampler, Sampler &samples, const RussianRoulette &rr) {
     SurfaceInteraction interact;
 
     if (depth == 0) return Spectrum();
     if (!scene.intersect(r, interact)) return scene.envMapValue(r);
 
-    const Point x = interact.p;
-    const Direction n = interact.n;
+    return Lo(interact, scene, depth, sampler, samples, rr);
+  }
+
+  Spectrum Lo(const SurfaceInteraction &interact, const Scene &scene, size_t depth, HemisphereSampler sampler, Sampler &samples, const RussianRoulette &rr) {
+    constexpr Float eps = 1e-4; // Self-shadow eps
 
-    const Spectrum Le = interact.material->Le();
-    if (Le.max() != 0) return Le; // Material emits
+    Spectrum L;
+    Spectrum beta(1, 1, 1); // Throughput of the path up to si
+    SurfaceInteraction si = interact;
 
-    const auto brdf = interact.material->sampleFr(interact);
-    if (brdf == nullptr) return Spectrum(); // Absorption
+    for (size_t bounces = 1; ; bounces++) {
+      samples.startVertex(bounces);
+      const Point x = si.p;
+      const Direction n = si.n;
 
-    Direction wi;
-    const Spectrum Fr = brdf->sampleFr(sampler, interact, wi);
-    const Float cosThetaI = brdf->cosThetaI(sampler, wi, n);
-    const Float p = brdf->p(sampler, wi);
+      const Spectrum Le = si.material->Le();
+      if (Le.max() != 0) return L + beta * Le; // Material emits
 
-    assert(Fr.min() >= 0, "Fr < 0, Physically based BRDFs are non-negative!");
+      const auto brdf = si.material->sampleFr(si, samples);
+      if (brdf == nullptr) break; // Absorption
 
-    const Spectrum Lp = scene.directLight(interact, brdf);
+      Direction wi;
+      const Spectrum Fr = brdf->sampleFr(sampler, si, wi, samples);
+      const Float cosThetaI = brdf->cosThetaI(sampler, wi, n);
+      const Float p = brdf->p(sampler, wi);
 
-    return Lp + Li(Ray(x + wi * eps, wi), scene, depth - 1, sampler) * Fr * cosThetaI / p;
+      assert(Fr.min() >= 0, "Fr < 0, Physically based BRDFs are non-negative!");
+
+      L += beta * scene.directLight(si, brdf);
+
+      if (bounces == depth) break;
+      beta *= Fr * cosThetaI / p;
+      if (!rr.survives(bounces, beta, samples)) break;
+
+      const Ray ray(x, wi, eps);
+      if (!scene.intersect(ray, si)) {
+        L += beta * scene.envMapValue(ray);
+        break;
+      }
+    }
+
+    return L;
   }
 
-  void render(std::shared_ptr<Camera> &camera, const Scene &scene, size_t spp, size_t maxDepth, HemisphereSampler sampler, uint seed) {
+  namespace {
+    // Adds the radiance of samples [firstSample, firstSample + spp) of every
+    // pixel of the tile to L and keeps their primary hits in si (both
+    // tile.width * tile.height, row by row). Pixels are traced in 4x4 blocks,
+    // the camera rays of each sample as a packet.
+    void traceTile(const Camera &camera, const Scene &scene, const utils::Tile &tile, size_t firstSample, size_t spp, size_t maxDepth,
+                   HemisphereSampler sampler, Sampler &samples, const RussianRoulette &rr, Spectrum L[], SurfaceInteraction si[]) {
+      const size_t width = camera.film.getWidth();
+      constexpr size_t block = 4;
+      static_assert(block * block <= packetSize, "A block must fit in a packet");
+
+      for (size_t by = 0; by < tile.height; by += block) {
+        for (size_t bx = 0; bx < tile.width; bx += block) {
+          const size_t w = std::min(block, tile.width - bx), h = std::min(block, tile.height - by);
+
+          SurfaceInteraction blockSi[packetSize];
+          for (size_t k = 0; k < w * h; k++) {
+            blockSi[k].t = 0;
+            blockSi[k].n = Direction(0, 0, 0);
+          }
+
+          Spectrum blockL[packetSize];
+          for (size_t s = firstSample; s < firstSample + spp; s++) {
+            const RayPacket packet = camera.getRays(tile.x0 + bx, tile.y0 + by, w, h, samples, s);
+
+            // The primary hits are shared by Li and the normal and depth AOVs
+            const uint32_t hits = scene.intersect(packet, blockSi);
+            for (size_t k = 0; k < w * h; k++) {
+              if (maxDepth == 0) continue;
+              samples.start((tile.y0 + by + k / w) * width + tile.x0 + bx + k % w, s);
+              blockL[k] += (hits & (1u << k)) ? Lo(blockSi[k], scene, maxDepth, sampler, samples, rr)
+                                              : scene.envMapValue(packet.rays[k]);
+            }
+          }
+
+          for (size_t k = 0; k < w * h; k++) {
+            const size_t idx = (by + k / w) * tile.width + bx + k % w;
+            L[idx] += blockL[k];
+            si[idx] = blockSi[k];
+          }
+
+          utils::Telemetry::addSamples(w * h * spp);
+        }
+      }
+    }
+
+    // Everything the samples of a checkpointed render depend on, except
+    // the sample count
+    uint64_t checkpointKey(const std::string &scene, size_t width, size_t height, size_t maxDepth, HemisphereSampler sampler,
+                           const SamplerConfig &samplerConfig, const RussianRoulette &rr) {
+      uint64_t key = utils::hash(scene.data(), scene.size());
+      const uint64_t settings[] = {
+        width, height, maxDepth, static_cast<uint64_t>(sampler),
+        static_cast<uint64_t>(samplerConfig.sequence), samplerConfig.seed, rr.minDepth
+      };
+      key = utils::hash(settings, sizeof(settings), key);
+      key = utils::hash(&rr.threshold, sizeof(Float), key);
+      key = utils::hash(&rr.minSurvival, sizeof(Float), key);
+      return key;
+    }
+
+    // Set by SIGINT and SIGTERM while a checkpointed render runs
+    volatile std::sig_atomic_t stopRequested = 0;
+    void requestStop(int) { stopRequested = 1; }
+  } // namespace
+
+  void render(std::shared_ptr<Camera> &camera, const Scene &scene, size_t spp, size_t maxDepth, HemisphereSampler sampler, const SamplerConfig &samplerConfig,
+              const RussianRoulette &rr, const utils::TileConfig &tiles) {
     const size_t width = camera->film.getWidth();
     const size_t height = camera->film.getHeight();
 
     auto start = std::chrono::high_resolution_clock::now();
 
-    // size_t iter = 0;
-    utils::lwpb pbar(width*height*spp, "Rendering");
+    utils::Telemetry telemetry(width*height*spp, "Rendering");
+
+    utils::TileScheduler(width, height, tiles).run([&](const utils::Tile &tile) {
+      std::vector<Spectrum> tileL(tile.width * tile.height);
+      std::vector<SurfaceInteraction> tileSi(tile.width * tile.height);
+      traceTile(*camera, scene, tile, 0, spp, maxDepth, sampler, *makeSampler(samplerConfig), rr, tileL.data(), tileSi.data());
 
-    #pragma omp parallel for
-    for (size_t i = 0; i < width; i++) {
-      for (size_t j = 0; j < height; j++) {
-        SurfaceInteraction si;
-        si.t = 0;
-        si.n = Direction(0, 0, 0);
+      // The whole tile goes to the film at once
+      for (size_t j = 0; j < tile.height; j++) {
+        for (size_t i = 0; i < tile.width; i++) {
+          const size_t idx = j * tile.width + i;
+          camera->writeColor(tile.x0 + i, tile.y0 + j, tileL[idx] / spp);
+          camera->writeNormal(tile.x0 + i, tile.y0 + j, tileSi[idx].n);
+          camera->writeDepth(tile.x0 + i, tile.y0 + j, tileSi[idx].t);
+          camera->writeSamples(tile.x0 + i, tile.y0 + j, spp);
+        }
+      }
+    });
+    telemetry.finish();
 
-        Spectrum L;
-        for (size_t s = 0; s < spp; s++) {
-          Ray r = camera->getRay(i, j, seed);
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+    std::cout << "[PATHTRACER " << width << "x" << height << "px " << spp << "spp] render took: " << utils::time::format(duration) << std::endl << std::endl;
+  }
+
+  void render(std::shared_ptr<Camera> &camera, const Scene &scene, const TimeBudget &budget, size_t maxDepth, HemisphereSampler sampler, const SamplerConfig &samplerConfig,
+              const RussianRoulette &rr, const utils::TileConfig &tiles) {
+    using Clock = std::chrono::steady_clock;
+    using Seconds = std::chrono::duration<double>;
+
+    const size_t width = camera->film.getWidth();
+    const size_t height = camera->film.getHeight();
+    const size_t nPixels = width * height;
+
+    const auto start = Clock::now();
+    const auto deadline = start + budget.budget;
+
+    // Running sums and sample counts per pixel, a pass cut short by the
+    // deadline leaves some pixels with more samples than others
+    std::vector<Spectrum> sum(nPixels);
+    std::vector<size_t> count(nPixels, 0);
+    std::vector<SurfaceInteraction> primary(nPixels);
+    for (SurfaceInteraction &si : primary) {
+      si.t = 0;
+      si.n = Direction(0, 0, 0);
+    }
 
-          scene.intersect(r, si);
-          L += Li(r, scene, maxDepth, sampler);
+    // Average so far, what the film will hold at the end
+    auto average = [&](size_t i) { return (count[i] > 0) ? sum[i] / count[i] : Spectrum(); };
 
-          #pragma omp critical
-          {
-            // iter++;
-            pbar.step();
+    const utils::TileScheduler scheduler(width, height, tiles);
+    utils::Telemetry telemetry(nPixels, "Rendering");
+
+    uint64_t samples = 0;
+    size_t passes = 0;
+    double secondsPerSpp = 0; // Measured cost of one sample of every pixel
+    auto lastSnapshot = start;
+
+    for (;;) {
+      const Seconds left = deadline - Clock::now();
+      if (left.count() <= 0) break;
+
+      // Passes last about a second (at most until the next snapshot) so that
+      // snapshots and the estimate stay up to date, the first one takes a
+      // single sample per pixel to measure the throughput
+      size_t spp = 1;
+      if (secondsPerSpp > 0) {
+        Seconds target = std::min(left, Seconds(1.0));
+        if (budget.snapshotInterval.count() > 0)
+          target = std::min<Seconds>(target, budget.snapshotInterval);
+        spp = std::max<size_t>(1, target.count() / secondsPerSpp);
+        telemetry.setTotal(samples + static_cast<uint64_t>(left.count() / secondsPerSpp * nPixels));
+      }
+
+      // Tiles that would start after the deadline are skipped
+      const auto passStart = Clock::now();
+      std::atomic<size_t> skipped{0};
+      scheduler.run([&](const utils::Tile &tile) {
+        if (Clock::now() >= deadline) {
+          skipped++;
+          return;
+        }
+
+        std::vector<Spectrum> tileL(tile.width * tile.height);
+        std::vector<SurfaceInteraction> tileSi(tile.width * tile.height);
+        // Every pixel of a tile has taken the same samples so far
+        const size_t taken = count[tile.y0 * width + tile.x0];
+        traceTile(*camera, scene, tile, taken, spp, maxDepth, sampler, *makeSampler(samplerConfig), rr, tileL.data(), tileSi.data());
+
+        for (size_t j = 0; j < tile.height; j++) {
+          for (size_t i = 0; i < tile.width; i++) {
+            const size_t pixel = (tile.y0 + j) * width + tile.x0 + i;
+            if (count[pixel] == 0) primary[pixel] = tileSi[j * tile.width + i];
+            sum[pixel] += tileL[j * tile.width + i];
+            count[pixel] += spp;
           }
         }
-        L /= spp;
+      });
+      const Seconds took = Clock::now() - passStart;
 
-        camera->writeColor(i, j, L);
-        camera->writeNormal(i, j, si.n);
-        camera->writeDepth(i, j, si.t);
+      if (skipped == 0) {
+        secondsPerSpp = took.count() / spp;
+        samples += spp * nPixels;
+        passes++;
+      } else {
+        samples = 0;
+        for (size_t c : count) samples += c;
+      }
 
-        #pragma omp critical
-        {
-          // std::cout << (float)iter * 100.0f / ((float)width*height*spp) << "%" << std::endl;
-          pbar.print(std::cout);
+      if (budget.snapshot && budget.snapshotInterval.count() > 0 && Clock::now() - lastSnapshot >= budget.snapshotInterval) {
+        image::Film film(width, height, camera->film.getColorRes());
+        for (size_t i = 0; i < nPixels; i++) {
+          const Spectrum L = average(i);
+          film[i] = image::Pixel(L.x, L.y, L.z);
         }
+        budget.snapshot(film);
+        lastSnapshot = Clock::now();
       }
     }
+    telemetry.setTotal(samples);
+    telemetry.finish();
+
+    for (size_t i = 0; i < nPixels; i++) {
+      const size_t x = i % width, y = i / width;
+      camera->writeColor(x, y, average(i));
+      camera->writeNormal(x, y, primary[i].n);
+      camera->writeDepth(x, y, primary[i].t);
+      camera->writeSamples(x, y, count[i]);
+    }
+
+    const auto [minSpp, maxSpp] = std::minmax_element(count.begin(), count.end());
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+    std::cout << "[PATHTRACER " << width << "x" << height << "px " << *minSpp;
+    if (*maxSpp != *minSpp) std::cout << "-" << *maxSpp;
+    std::cout << "spp in " << passes << " full passes] render took: " << utils::time::format(duration) << std::endl << std::endl;
+  }
+
+  void render(std::shared_ptr<Camera> &camera, const Scene &scene, const AdaptiveSampling &adaptive, size_t maxDepth, HemisphereSampler sampler, const SamplerConfig &samplerConfig,
+              const RussianRoulette &rr, const utils::TileConfig &tiles) {
+    const size_t width = camera->film.getWidth();
+    const size_t height = camera->film.getHeight();
+    const size_t nPixels = width * height;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    image::VarianceBuffer &variance = camera->variance;
+    std::vector<SurfaceInteraction> primary(nPixels);
+    for (SurfaceInteraction &si : primary) {
+      si.t = 0;
+      si.n = Direction(0, 0, 0);
+    }
+
+    const utils::TileScheduler scheduler(width, height, tiles);
+    utils::Telemetry telemetry(nPixels * adaptive.spp, "Rendering");
+
+    // Samples each pixel takes in the next round, 0 once it has converged.
+    // After the first round the count is estimated from the error, which
+    // falls as 1 / sqrt(samples), but it at most doubles per round.
+    std::vector<uint32_t> extra(nPixels, adaptive.spp);
+    std::vector<Float> error(nPixels);
+
+    uint64_t samples = 0;
+    size_t rounds = 0;
+    for (uint64_t planned = nPixels * adaptive.spp; planned > 0; rounds++) {
+      telemetry.setTotal(samples + planned);
+
+      scheduler.run([&](const utils::Tile &tile) {
+        const std::unique_ptr<Sampler> pixelSamples = makeSampler(samplerConfig);
+        std::vector<uint32_t> pixels; // Active pixels of the tile
+        for (size_t j = 0; j < tile.height; j++) {
+          for (size_t i = 0; i < tile.width; i++) {
+            const size_t pixel = (tile.y0 + j) * width + tile.x0 + i;
+            if (extra[pixel] > 0) pixels.push_back(pixel);
+          }
+        }
+
+        // Camera rays of each sample of up to packetSize pixels as a packet,
+        // lanes drop out as their pixels get their samples. The variance
+        // needs every sample on its own.
+        for (size_t first = 0; first < pixels.size(); first += packetSize) {
+          const size_t n = std::min<size_t>(packetSize, pixels.size() - first);
+
+          SurfaceInteraction si[packetSize];
+          size_t spp = 0;
+          for (size_t k = 0; k < n; k++) {
+            si[k].t = 0;
+            si[k].n = Direction(0, 0, 0);
+            spp = std::max<size_t>(spp, extra[pixels[first + k]]);
+          }
+
+          uint64_t taken = 0;
+          for (size_t s = 0; s < spp; s++) {
+            RayPacket packet;
+            for (size_t k = 0; k < n; k++) {
+              const size_t pixel = pixels[first + k];
+              if (s >= extra[pixel]) continue;
+              pixelSamples->start(pixel, variance.samples(pixel));
+              packet.set(k, camera->getRay(pixel % width, pixel / width, *pixelSamples));
+            }
+
+            const uint32_t hits = scene.intersect(packet, si);
+            for (size_t k = 0; k < n; k++) {
+              if (!(packet.mask & (1u << k))) continue;
+              Spectrum L;
+              pixelSamples->start(pixels[first + k], variance.samples(pixels[first + k]));
+              if (maxDepth > 0)
+                L = (hits & (1u << k)) ? Lo(si[k], scene, maxDepth, sampler, *pixelSamples, rr) : scene.envMapValue(packet.rays[k]);
+              variance.add(pixels[first + k], image::Pixel(L.x, L.y, L.z));
+              taken++;
+            }
+          }
+
+          if (rounds == 0)
+            for (size_t k = 0; k < n; k++) primary[pixels[first + k]] = si[k];
+
+          utils::Telemetry::addSamples(taken);
+        }
+      });
+      samples += planned;
+
+      #pragma omp parallel for
+      for (size_t i = 0; i < nPixels; i++)
+        error[i] = variance.relativeError(i);
+
+      // Variance estimates from few samples miss rare bright paths, so the
+      // error of a pixel is the worst one of its 3x3 neighbourhood
+      planned = 0;
+      #pragma omp parallel for reduction(+:planned)
+      for (size_t i = 0; i < nPixels; i++) {
+        const size_t x = i % width, y = i / width;
+        Float worst = 0;
+        for (size_t ny = (y > 0) ? y - 1 : 0; ny <= std::min(y + 1, height - 1); ny++)
+          for (size_t nx = (x > 0) ? x - 1 : 0; nx <= std::min(x + 1, width - 1); nx++)
+            worst = std::max(worst, error[ny * width + nx]);
+
+        const size_t n = variance.samples(i);
+        size_t more = 0;
+        if (worst > adaptive.threshold) {
+          const Float needed = n * (worst / adaptive.threshold) * (worst / adaptive.threshold) - n;
+          more = std::min<Float>(n, std::max<Float>(adaptive.spp, std::ceil(needed)));
+        }
+        if (adaptive.maxSpp > 0)
+          more = std::min(more, (adaptive.maxSpp > n) ? adaptive.maxSpp - n : 0);
+
+        extra[i] = more;
+        planned += more;
+      }
+    }
+    telemetry.setTotal(samples);
+    telemetry.finish();
+
+    size_t maxSpp = 0;
+    for (size_t i = 0; i < nPixels; i++) {
+      const size_t x = i % width, y = i / width;
+      const image::Pixel mean = variance.mean(i);
+      camera->writeColor(x, y, Spectrum(mean.r, mean.g, mean.b));
+      camera->writeNormal(x, y, primary[i].n);
+      camera->writeDepth(x, y, primary[i].t);
+      camera->writeSamples(x, y, variance.samples(i));
+      maxSpp = std::max(maxSpp, variance.samples(i));
+    }
 
     auto stop = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
-    std::cout << "[PATHTRACER " << width << "x" << height << "px " << spp << "spp] render took: " << utils::time::format(duration) << std::endl << std::endl;
+    std::cout << "[PATHTRACER " << width << "x" << height << "px adaptive " << adaptive.spp << "-" << maxSpp << "spp, "
+              << std::fixed << std::setprecision(1) << static_cast<double>(samples) / nPixels << std::defaultfloat
+              << " avg in " << rounds << " rounds] render took: " << utils::time::format(duration) << std::endl << std::endl;
+  }
+
+  bool render(std::shared_ptr<Camera> &camera, const Scene &scene, const Checkpointing &checkpointing, size_t maxDepth, HemisphereSampler sampler, const SamplerConfig &samplerConfig,
+              const RussianRoulette &rr, const utils::TileConfig &tiles) {
+    using Clock = std::chrono::steady_clock;
+
+    const size_t width = camera->film.getWidth();
+    const size_t height = camera->film.getHeight();
+    const size_t nPixels = width * height;
+    const size_t spp = checkpointing.spp;
+    const image::Shard &shard = checkpointing.shard;
+    const bool bySamples = shard.partition == image::ShardPartition::Samples;
+
+    uint64_t key = checkpointKey(checkpointing.scene, width, height, maxDepth, sampler, samplerConfig, rr);
+    if (!bySamples) {
+      // Every shard must cut the image in the same tiles
+      const uint64_t tiling[] = {tiles.size, static_cast<uint64_t>(tiles.order)};
+      key = utils::hash(tiling, sizeof(tiling), key);
+    }
+
+    // Shard i of N takes samples i, i + N, ... or the whole of every N-th tile
+    utils::TileScheduler scheduler(width, height, tiles);
+    if (!bySamples) scheduler.stride(shard.index, shard.count);
+    const size_t target = !bySamples ? spp : (spp > shard.index) ? (spp - shard.index + shard.count - 1) / shard.count : 0;
+    auto sampleIndex = [&](size_t taken) { return bySamples ? shard.index + taken * shard.count : taken; };
+
+    size_t shardPixels = 0;
+    for (size_t t = 0; t < scheduler.size(); t++) shardPixels += scheduler[t].width * scheduler[t].height;
+
+    const auto start = Clock::now();
+
+    image::Accumulation acc(width, height);
+    acc.spp = spp;
+    acc.shard = shard;
+    if (checkpointing.resume && std::filesystem::exists(checkpointing.filename)) {
+      acc = image::load(checkpointing.filename, key);
+      if (!(acc.shard == shard))
+        throw std::runtime_error(checkpointing.filename + " is another shard of the render");
+      acc.spp = spp;
+    }
+
+    // Checkpoints are only taken between passes, every pixel of the shard
+    // has the same sample count
+    const size_t resumed = *std::max_element(acc.count.begin(), acc.count.end());
+    if (resumed > 0)
+      std::cout << "Resuming " << checkpointing.filename << " at " << resumed << "spp" << std::endl;
+
+    stopRequested = 0;
+    const auto previousInt = std::signal(SIGINT, requestStop);
+    const auto previousTerm = std::signal(SIGTERM, requestStop);
+
+    utils::Telemetry telemetry(shardPixels * (target - std::min(resumed, target)), "Rendering");
+
+    // One sample per pass, so that the sums add the samples in the same
+    // order wherever the render was stopped
+    auto lastCheckpoint = start;
+    size_t s = resumed;
+    for (; s < target && !stopRequested; s++) {
+      scheduler.run([&](const utils::Tile &tile) {
+        std::vector<Spectrum> tileL(tile.width * tile.height);
+        std::vector<SurfaceInteraction> tileSi(tile.width * tile.height);
+        traceTile(*camera, scene, tile, sampleIndex(s), 1, maxDepth, sampler, *makeSampler(samplerConfig), rr, tileL.data(), tileSi.data());
+
+        for (size_t j = 0; j < tile.height; j++) {
+          for (size_t i = 0; i < tile.width; i++) {
+            const size_t pixel = (tile.y0 + j) * width + tile.x0 + i;
+            if (acc.count[pixel] == 0) {
+              acc.normal[pixel] = tileSi[j * tile.width + i].n;
+              acc.depth[pixel] = tileSi[j * tile.width + i].t;
+            }
+            acc.sum[pixel] += tileL[j * tile.width + i];
+            acc.count[pixel]++;
+          }
+        }
+      });
+
+      if (checkpointing.interval.count() > 0 && Clock::now() - lastCheckpoint >= checkpointing.interval) {
+        image::save(checkpointing.filename, acc, key);
+        lastCheckpoint = Clock::now();
+      }
+    }
+    telemetry.finish();
+
+    if (s > resumed || !std::filesystem::exists(checkpointing.filename))
+      image::save(checkpointing.filename, acc, key);
+    std::signal(SIGINT, previousInt);
+    std::signal(SIGTERM, previousTerm);
+
+    for (size_t i = 0; i < nPixels; i++) {
+      const size_t x = i % width, y = i / width;
+      camera->writeColor(x, y, (acc.count[i] > 0) ? acc.sum[i] / acc.count[i] : Spectrum());
+      camera->writeNormal(x, y, acc.normal[i]);
+      camera->writeDepth(x, y, acc.depth[i]);
+      camera->writeSamples(x, y, acc.count[i]);
+    }
+
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+    std::cout << "[PATHTRACER " << width << "x" << height << "px " << s << "/" << target << "spp";
+    if (shard.count > 1)
+      std::cout << ", shard " << shard.index << "/" << shard.count << " by " << (bySamples ? "samples" : "tiles");
+    std::cout << ", checkpoint " << checkpointing.filename << "] render took: " << utils::time::format(duration) << std::endl << std::endl;
+    return s >= target;
   }
 }
@@ -4,11 +4,87 @@
 #include "materials/slides.hh"
 #include "camera.hh"
 #include "scene.hh"
+#include "sampler.hh"
+#include "image/accumulation.hh"
+#include "utils/tiles.hh"
+#include <chrono>
+#include <functional>
 #include <memory>
+#include <string>
 
 namespace pathtracer {
-  Spectrum Li(const Ray &r, const Scene &scene, size_t depth, HemisphereSampler sampler);
-  void render(std::shared_ptr<Camera> &camera, const Scene &scene, size_t spp, size_t maxDepth, HemisphereSampler sampler = COSINE, uint seed = 5489u);
+  // Unbiased path termination: once a path has made minDepth bounces and its
+  // throughput is below threshold, it survives with probability equal to its
+  // throughput (at least minSurvival) and is weighted up if it does.
+  // threshold 0 disables it.
+  struct RussianRoulette {
+    size_t minDepth = 3;
+    Float threshold = 1;
+    Float minSurvival = 0.05;
+
+    // Decides whether a path that has made the given bounces goes on,
+    // rescaling beta if it does
+    bool survives(size_t bounces, Spectrum &beta, Sampler &samples) const;
+  };
+
+  // Progressive rendering until a deadline instead of a fixed spp
+  struct TimeBudget {
+    std::chrono::milliseconds budget;
+    // Every snapshotInterval (never if 0), snapshot gets the image so far
+    std::chrono::milliseconds snapshotInterval{0};
+    std::function<void(const image::Film &)> snapshot;
+  };
+
+  // Rounds of spp samples per pixel, after the first one only for the pixels
+  // whose relative error (see image::VarianceBuffer) is still above threshold
+  struct AdaptiveSampling {
+    size_t spp;
+    Float threshold;
+    size_t maxSpp = 0; // Per pixel cap, none if 0
+  };
+
+  // Fixed spp render that survives being stopped: it goes in passes of one
+  // sample per pixel and, every interval and at the end, saves what it has
+  // accumulated to filename. Samples are a function of the seed and the
+  // sample counts, so a resumed render gives the very image an uninterrupted
+  // one would, and raising spp carries on a finished one. scene names the
+  // scene, a checkpoint only resumes the render that wrote it.
+  // With a shard the render only takes its part of the samples (see
+  // image::Shard), and the shards of every process are added up with
+  // image::merge.
+  struct Checkpointing {
+    size_t spp;
+    std::string filename;
+    std::string scene;
+    std::chrono::milliseconds interval{0}; // Only at the end if 0
+    bool resume = false; // Start from filename if it exists
+    image::Shard shard;
+  };
+
+  // samples must have been started at the sample of the pixel the path
+  // belongs to, every bounce takes the dimensions of its vertex
+  Spectrum Li(const Ray &r, const Scene &scene, size_t depth, HemisphereSampler sampler, Sampler &samples,
+              const RussianRoulette &rr = RussianRoulette());
+  // Radiance leaving the surface hit at interact back along the ray that found it
+  Spectrum Lo(const SurfaceInteraction &interact, const Scene &scene, size_t depth, HemisphereSampler sampler, Sampler &samples,
+              const RussianRoulette &rr = RussianRoulette());
+  void render(std::shared_ptr<Camera> &camera, const Scene &scene, size_t spp, size_t maxDepth, HemisphereSampler sampler = COSINE, const SamplerConfig &samplerConfig = SamplerConfig(),
+              const RussianRoulette &rr = RussianRoulette(), const utils::TileConfig &tiles = utils::TileConfig());
+  // Renders passes over the whole image until the budget runs out, sizing them
+  // from the measured throughput. Tiles are not started past the deadline, so
+  // pixels may end up with different sample counts, each one is averaged over
+  // its own.
+  void render(std::shared_ptr<Camera> &camera, const Scene &scene, const TimeBudget &budget, size_t maxDepth, HemisphereSampler sampler = COSINE, const SamplerConfig &samplerConfig = SamplerConfig(),
+              const RussianRoulette &rr = RussianRoulette(), const utils::TileConfig &tiles = utils::TileConfig());
+  // Adaptive sampling, with the running statistics in camera->variance. The
+  // film gets the mean of every pixel and sFilm its sample count.
+  void render(std::shared_ptr<Camera> &camera, const Scene &scene, const AdaptiveSampling &adaptive, size_t maxDepth, HemisphereSampler sampler = COSINE, const SamplerConfig &samplerConfig = SamplerConfig(),
+              const RussianRoulette &rr = RussianRoulette(), const utils::TileConfig &tiles = utils::TileConfig());
+  // SIGINT and SIGTERM stop the render at the end of the pass, after saving
+  // a checkpoint. Returns false if it was stopped, the film then holds the
+  // image so far.
+  bool render(std::shared_ptr<Camera> &camera, const Scene &scene, const Checkpointing &checkpointing, size_t maxDepth, HemisphereSampler sampler = COSINE, const SamplerConfig &samplerConfig = SamplerConfig(),
+              const RussianRoulette &rr = RussianRoulette(), const utils::TileConfig &tiles = utils::TileConfig());
 } // namespace pathtracer
 
 #endif // PATHTRACER_H_
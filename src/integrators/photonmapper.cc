@@ -3,7 +3,7 @@
 #include <list>
 #include "../utils/time.hh"
 
-#include "../utils/lwpb.hh"
+#include "../utils/telemetry.hh"
 
 namespace kernel {
   class Kernel {
@@ -57,60 +57,104 @@ namespace photonmapper {
     std::list<Photon> global;  // L{S|D}*D
   };
 
-  PhotonMaps randomWalk2(Ray r, const Scene &scene, Flux flux, size_t depth, HemisphereSampler sampler, bool storeFirst) {
+  // Photon paths are the samples of a pixel no camera path uses, numbered by
+  // their emission order over every light
+  constexpr uint64_t photonPixel = ~0ull;
+
+  // Random walks of a batch of photons, all of them advance one bounce at a
+  // time through Scene's stream intersection. Photon i is sample ids[i].
+  PhotonMaps randomWalks(std::vector<Ray> &&rays, std::vector<uint64_t> &&ids, Flux flux, const Scene &scene, size_t depth,
+                         HemisphereSampler sampler, const SamplerConfig &samplerConfig, bool storeFirst) {
     constexpr Float eps = 1e-4; // Self-shadow eps
-    
+
     PhotonMaps maps;
 
-    SurfaceInteraction interact;
+    const size_t nPhotons = rays.size();
+    std::vector<Flux> fluxes(nPhotons, flux);
+    std::vector<uint8_t> isFirst(nPhotons, true), isCaustic(nPhotons, true), alive(nPhotons);
+    std::vector<SurfaceInteraction> interacts(nPhotons);
+    std::vector<uint8_t> hit(nPhotons);
+
+    for (size_t i = 0; i < depth && !rays.empty(); i++) {
+      const size_t m = rays.size();
+      scene.intersect(rays.data(), m, interacts.data(), hit.data());
+
+      #pragma omp parallel
+      {
+        PhotonMaps local;
+        const std::unique_ptr<Sampler> samples = makeSampler(samplerConfig);
+
+        #pragma omp for
+        for (size_t j = 0; j < m; j++) {
+          alive[j] = false;
+          if (!hit[j]) continue;
+
+          const SurfaceInteraction &interact = interacts[j];
+          const Point x = interact.p;
+          const Direction n = interact.n;
+          const Direction wo = interact.wo;
+
+          samples->start(photonPixel, ids[j]);
+          samples->startVertex(i + 1);
+          const auto brdf = interact.material->sampleFr(interact, *samples);
+          if (brdf == nullptr) continue; // Absorption
+
+          Direction wi;
+          const Spectrum Fr = brdf->sampleFr(sampler, interact, wi, *samples);
+          const Float cosThetaI = brdf->cosThetaI(sampler, wi, n);
+          const Float p = brdf->p(sampler, wi);
+
+          if (!brdf->isDelta) {
+            // Delta materials just propagate
+            const bool store = storeFirst || !isFirst[j];
+            isFirst[j] = false;
+
+            if (store) {
+              if (isCaustic[j])
+                local.caustic.push_back(Photon(x, wo, fluxes[j]));
+              else
+                local.global.push_back(Photon(x, wo, fluxes[j]));
+            }
+
+            isCaustic[j] = false;
+          }
+          rays[j] = Ray(x, wi, eps);
+          fluxes[j] *= Fr * cosThetaI / p;
+          alive[j] = true;
+        }
 
-    bool isFirst = true;
-    bool isCaustic = true;
-    for (size_t i = 0; i < depth; i++) {
-      if (!scene.intersect(r, interact)) break;
-
-      const Point x = interact.p;
-      const Direction n = interact.n;
-      const Direction wo = interact.wo;
-
-      const auto brdf = interact.material->sampleFr(interact);
-      if (brdf == nullptr) break; // Absorption
-
-      Direction wi;
-      const Spectrum Fr = brdf->sampleFr(sampler, interact, wi);
-      const Float cosThetaI = brdf->cosThetaI(sampler, wi, n);
-      const Float p = brdf->p(sampler, wi);
-
-      if (brdf->isDelta) {
-        // Delta material, just propagate
-        r = Ray(x + wi * eps, wi);
-        flux *= Fr * cosThetaI / p;
-      } else {
-        const bool store = storeFirst || !isFirst;
-        isFirst = false;
-
-        if (store) {
-          if (isCaustic) 
-            maps.caustic.push_back(Photon(x, wo, flux));
-          else
-            maps.global.push_back(Photon(x, wo, flux));
+        #pragma omp critical
+        {
+          maps.caustic.splice(maps.caustic.end(), local.caustic);
+          maps.global.splice(maps.global.end(), local.global);
         }
-        
-        isCaustic = false;
-        r = Ray(x + wi * eps, wi);
-        flux *= Fr * cosThetaI / p;
       }
+
+      // Keep going with the photons that bounced
+      size_t k = 0;
+      for (size_t j = 0; j < m; j++) {
+        if (!alive[j]) continue;
+        rays[k] = rays[j];
+        fluxes[k] = fluxes[j];
+        ids[k] = ids[j];
+        isFirst[k] = isFirst[j];
+        isCaustic[k] = isCaustic[j];
+        k++;
+      }
+      rays.resize(k);
     }
 
     return maps;
   }
 
-  Spectrum Li(const Ray &r, const Scene &scene, const PhotonMap &globalMap, const PhotonMap &causticMap, ulong k, Float rk, size_t depth, HemisphereSampler sampler, bool nextEventEstimation, const kernel::Kernel &kernel) {
+  Spectrum Li(const Ray &r, const Scene &scene, const PhotonMap &globalMap, const PhotonMap &causticMap, ulong k, Float rk, size_t depth, HemisphereSampler sampler, Sampler &samples, bool nextEventEstimation, const kernel::Kernel &kernel) {
     constexpr Float eps = 1e-4; // Self-shadow eps
 
     SurfaceInteraction interact;
 
     if (depth == 0) return Spectrum();
+    // depth counts down from maxDepth, every bounce still gets its own block
+    samples.startVertex(depth);
     if (!scene.intersect(r, interact)) return scene.envMapValue(r);
 
     const Point x = interact.p;
@@ -119,16 +163,16 @@ namespace photonmapper {
     const Spectrum Le = interact.material->Le();
     if (Le.max() != 0) return Le; // Material emits
 
-    const auto brdf = interact.material->sampleFr(interact);
+    const auto brdf = interact.material->sampleFr(interact, samples);
     if (brdf == nullptr) return Spectrum(); // Absorption
 
     Direction wi;
-    const Spectrum Fr = brdf->sampleFr(sampler, interact, wi);
+    const Spectrum Fr = brdf->sampleFr(sampler, interact, wi, samples);
     const Float cosThetaI = brdf->cosThetaI(sampler, wi, n);
     const Float p = brdf->p(sampler, wi);
 
     if (brdf->isDelta)
-      return Li(Ray(x + wi * eps, wi), scene, globalMap, causticMap, k, rk, depth - 1, sampler, nextEventEstimation, kernel);
+      return Li(Ray(x, wi, eps), scene, globalMap, causticMap, k, rk, depth - 1, sampler, samples, nextEventEstimation, kernel);
 
     Spectrum L;
     auto nearest = globalMap.nearest_neighbors(x, k, rk);
@@ -159,7 +203,7 @@ namespace photonmapper {
 
   void render(std::shared_ptr<Camera> &camera, const Scene &scene, size_t spp, size_t maxDepth,
               size_t nRandomWalks, unsigned long k, float rk, bool nextEventEstimation, 
-              HemisphereSampler sampler) {
+              HemisphereSampler sampler, const SamplerConfig &samplerConfig, const utils::TileConfig &tiles) {
     const size_t width = camera->film.getWidth();
     const size_t height = camera->film.getHeight();
 
@@ -180,73 +224,94 @@ namespace photonmapper {
       nPhotons[i] = nRandomWalks * std::round(scene.lights[i].power.norm() / totalPower);
 
 
-    utils::lwpb pbar(nRandomWalks, "Photon Mapping");
+    utils::Telemetry photonTelemetry(nRandomWalks, "Photon Mapping");
+
+    uint64_t photon = 0; // Index of the first photon of the batch, over every light
 
-    uint seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
     // TODO: area lights????
     for (size_t i = 0; i < scene.lights.size(); i++) {
       const auto &light = scene.lights[i];
       const size_t n = nPhotons[i];
 
-      #pragma omp parallel for
-      for (size_t s = 0; s < n; s++) {
-        // TODO: P mal
-        const Float theta = std::acos(2 * uniform(0, 1, seed) - 1);
-        const Float phi = 2 * M_PI * uniform(0, 1, seed);
-
-        const Flux flux = light.power * 4.0 * M_PI / n;
+      const Flux flux = light.power * 4.0 * M_PI / n;
 
-        const Direction wi = Direction(std::sin(theta) * std::cos(phi),
-                                       std::sin(theta) * std::sin(phi),
-                                       std::cos(theta));
-        const Ray ray(light.p, wi); 
+      // Photons are shot in batches, each traced as a stream
+      constexpr size_t batchSize = 1 << 16;
+      for (size_t first = 0; first < n; first += batchSize) {
+        std::vector<Ray> rays(std::min(batchSize, n - first));
+        std::vector<uint64_t> ids(rays.size());
 
-        auto [caustic, global] = randomWalk2(ray, scene, flux, maxDepth, sampler, !nextEventEstimation);
-        #pragma omp critical
+        #pragma omp parallel
         {
-          photons.splice(photons.end(), global);
-          photons2.splice(photons2.end(), caustic);
-          pbar.update();
+          const std::unique_ptr<Sampler> samples = makeSampler(samplerConfig);
+          #pragma omp for
+          for (size_t s = 0; s < rays.size(); s++) {
+            ids[s] = photon + s;
+            samples->start(photonPixel, ids[s]);
+            const Vec2 u = samples->get2D();
+            // TODO: P mal
+            const Float theta = std::acos(2 * u.x - 1);
+            const Float phi = 2 * M_PI * u.y;
+
+            const Direction wi = Direction(std::sin(theta) * std::cos(phi),
+                                           std::sin(theta) * std::sin(phi),
+                                           std::cos(theta));
+            rays[s] = Ray(light.p, wi);
+          }
         }
+
+        const size_t count = rays.size();
+        photon += count;
+        auto [caustic, global] = randomWalks(std::move(rays), std::move(ids), flux, scene, maxDepth, sampler, samplerConfig, !nextEventEstimation);
+        photons.splice(photons.end(), global);
+        photons2.splice(photons2.end(), caustic);
+        utils::Telemetry::addSamples(count);
       }
     }
 
     PhotonMap photonMap(photons, PhotonAxisPositition());
     PhotonMap photonMap2(photons2, PhotonAxisPositition());
 
-    pbar = utils::lwpb(width*height*spp, "Rendering");
+    photonTelemetry.finish();
 
-    #pragma omp parallel for
-    for (size_t i = 0; i < width; i++) {
-      for (size_t j = 0; j < height; j++) {
-        SurfaceInteraction si;
-        si.t = 0;
-        si.n = Direction(0, 0, 0);
+    utils::Telemetry telemetry(width*height*spp, "Rendering");
 
-        Spectrum L;
-        for (size_t s = 0; s < spp; s++) {
-          Ray r = camera->getRay(i, j);
+    utils::TileScheduler(width, height, tiles).run([&](const utils::Tile &tile) {
+      std::vector<Spectrum> tileL(tile.width * tile.height);
+      std::vector<SurfaceInteraction> tileSi(tile.width * tile.height);
+      const std::unique_ptr<Sampler> samples = makeSampler(samplerConfig);
 
-          scene.intersect(r, si);
-          L += Li(r, scene, photonMap, photonMap2, k, rk, maxDepth, sampler, nextEventEstimation, kernel::Cone());
+      for (size_t j = 0; j < tile.height; j++) {
+        for (size_t i = 0; i < tile.width; i++) {
+          SurfaceInteraction &si = tileSi[j * tile.width + i];
+          si.t = 0;
+          si.n = Direction(0, 0, 0);
 
-          #pragma omp critical
-          {
-            pbar.step();
+          Spectrum L;
+          for (size_t s = 0; s < spp; s++) {
+            samples->start((tile.y0 + j) * width + tile.x0 + i, s);
+            Ray r = camera->getRay(tile.x0 + i, tile.y0 + j, *samples);
+
+            scene.intersect(r, si);
+            L += Li(r, scene, photonMap, photonMap2, k, rk, maxDepth, sampler, *samples, nextEventEstimation, kernel::Cone());
           }
+          tileL[j * tile.width + i] = L / spp;
         }
-        L /= spp;
-
-        camera->writeColor(i, j, L);
-        camera->writeNormal(i, j, si.n);
-        camera->writeDepth(i, j, si.t);
+      }
 
-        #pragma omp critical
-        {
-          pbar.print();
+      // The whole tile goes to the film at once
+      for (size_t j = 0; j < tile.height; j++) {
+        for (size_t i = 0; i < tile.width; i++) {
+          const size_t idx = j * tile.width + i;
+          camera->writeColor(tile.x0 + i, tile.y0 + j, tileL[idx]);
+          camera->writeNormal(tile.x0 + i, tile.y0 + j, tileSi[idx].n);
+          camera->writeDepth(tile.x0 + i, tile.y0 + j, tileSi[idx].t);
         }
       }
-    }
+
+      utils::Telemetry::addSamples(tile.width * tile.height * spp);
+    });
+    telemetry.finish();
 
     auto stop = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
@@ -7,9 +7,11 @@
 
 #include "camera.hh"
 #include "scene.hh"
+#include "sampler.hh"
 #include "materials/slides.hh"
 #include "shapes/primitive.hh"
 #include "lights.hh"
+#include "utils/tiles.hh"
 
 typedef Direction Flux; // TODO
 
@@ -37,7 +39,7 @@ namespace photonmapper {
 
   void render(std::shared_ptr<Camera> &camera, const Scene &scene, size_t spp, size_t maxDepth,
               size_t nRandomWalks, unsigned long k, float rk, bool nextEventEstimation, 
-              HemisphereSampler sampler = COSINE);
+              HemisphereSampler sampler = COSINE, const SamplerConfig &samplerConfig = SamplerConfig(), const utils::TileConfig &tiles = utils::TileConfig());
 } // namespace photonmapper
 
 #endif // PHOTONMAPPER_H_
@@ -0,0 +1,315 @@
+#include "wavefront.hh"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include "geometry.hh"
+#include "../utils/time.hh"
+#include "../utils/telemetry.hh"
+
+namespace wavefront {
+  namespace {
+    // Parallel prefix sum over keep: slot[i] is the number of kept entries
+    // before i, which is where entry i goes once compacted. Returns how many
+    // entries are kept.
+    size_t compactionSlots(const std::vector<uint8_t> &keep, std::vector<uint32_t> &slot) {
+      const size_t n = keep.size();
+      slot.resize(n);
+      std::vector<size_t> chunkStart;
+
+      // Every thread counts its own chunk, the chunks are then offset by the
+      // totals of the ones before them
+      #pragma omp parallel
+      {
+        const size_t nThreads = omp_get_num_threads(), t = omp_get_thread_num();
+        #pragma omp single
+        chunkStart.assign(nThreads + 1, 0);
+
+        const size_t lo = n * t / nThreads, hi = n * (t + 1) / nThreads;
+        size_t count = 0;
+        for (size_t i = lo; i < hi; i++) {
+          slot[i] = count;
+          count += keep[i] != 0;
+        }
+        chunkStart[t + 1] = count;
+        #pragma omp barrier
+
+        #pragma omp single
+        for (size_t c = 1; c <= nThreads; c++) chunkStart[c] += chunkStart[c - 1];
+
+        for (size_t i = lo; i < hi; i++) slot[i] += chunkStart[t];
+      }
+      return chunkStart.back();
+    }
+
+    // Paths waiting for their next closest hit
+    struct PathQueue {
+      void resize(size_t n) {
+        rays.resize(n);
+        beta.resize(n);
+        path.resize(n);
+      }
+      size_t size() const { return rays.size(); }
+
+      // Keeps the entries of from whose keep flag is set, in order
+      void compact(const PathQueue &from, const std::vector<uint8_t> &keep, std::vector<uint32_t> &slot) {
+        resize(compactionSlots(keep, slot));
+        #pragma omp parallel for
+        for (size_t i = 0; i < from.size(); i++) {
+          if (!keep[i]) continue;
+          rays[slot[i]] = from.rays[i];
+          beta[slot[i]] = from.beta[i];
+          path[slot[i]] = from.path[i];
+        }
+      }
+
+      std::vector<Ray> rays;
+      std::vector<Spectrum> beta;    // Path throughput
+      std::vector<uint32_t> path;    // Index of the path in the wave
+    };
+
+    // Light connections, L is added to the path if the ray is not blocked
+    struct ShadowQueue {
+      void resize(size_t n) {
+        rays.resize(n);
+        L.resize(n);
+        path.resize(n);
+      }
+      size_t size() const { return rays.size(); }
+
+      // Keeps the entries of from whose keep flag is set, in order
+      void compact(const ShadowQueue &from, const std::vector<uint8_t> &keep, std::vector<uint32_t> &slot) {
+        resize(compactionSlots(keep, slot));
+        #pragma omp parallel for
+        for (size_t i = 0; i < from.size(); i++) {
+          if (!keep[i]) continue;
+          rays[slot[i]] = from.rays[i];
+          L[slot[i]] = from.L[i];
+          path[slot[i]] = from.path[i];
+        }
+      }
+
+      std::vector<Ray> rays;
+      std::vector<Spectrum> L;
+      std::vector<uint32_t> path;
+    };
+
+    enum Stage { Generate, Extend, Sort, Shade, Connect, nStages };
+    const char *stageNames[nStages] = {"generate", "extend", "sort", "shade", "connect"};
+
+    using Seconds = std::chrono::duration<double>;
+
+    // Runs f and adds its wall time to the stage
+    template <typename F>
+    void timed(Seconds times[], Stage stage, F &&f) {
+      const auto start = std::chrono::high_resolution_clock::now();
+      f();
+      times[stage] += std::chrono::high_resolution_clock::now() - start;
+    }
+  } // namespace
+
+  void render(std::shared_ptr<Camera> &camera, const Scene &scene, size_t spp, size_t maxDepth, HemisphereSampler sampler, const SamplerConfig &samplerConfig,
+              const pathtracer::RussianRoulette &rr) {
+    constexpr Float eps = 1e-4;      // Self-shadow eps
+    constexpr Float shadowEps = 5e-4; // As Scene::directLight
+    // Paths traced together. Paths are numbered sample-major (path j is
+    // sample j / nPixels of pixel j % nPixels) and a wave is a range of them,
+    // so small images put several samples of every pixel in the same wave
+    // and large ones are split into pixel ranges.
+    constexpr size_t waveSize = 1 << 18;
+
+    const size_t width = camera->film.getWidth();
+    const size_t height = camera->film.getHeight();
+    const size_t nPixels = width * height;
+    const size_t nLights = scene.lights.size();
+    const size_t nPaths = nPixels * spp;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    utils::Telemetry telemetry(nPixels * spp, "Rendering");
+
+    Seconds times[nStages] = {};
+    std::vector<Spectrum> image(nPixels);
+    std::vector<Direction> normals(nPixels);
+    std::vector<Float> depths(nPixels, 0);
+
+    // Storage reused by every wave and bounce
+    PathQueue paths, next;
+    ShadowQueue shadow, connect;
+    std::vector<SurfaceInteraction> interacts;
+    std::vector<uint32_t> order, slots;
+    std::vector<uint8_t> hit, occluded, alive, lit;
+
+    for (size_t begin = 0; begin < nPaths; begin += waveSize) {
+      const size_t n = std::min(waveSize, nPaths - begin);
+      std::vector<Spectrum> L(n); // Radiance of each path of the wave
+
+      timed(times, Generate, [&]() {
+        paths.resize(n);
+        #pragma omp parallel
+        {
+          const std::unique_ptr<Sampler> samples = makeSampler(samplerConfig);
+          #pragma omp for
+          for (size_t i = 0; i < n; i++) {
+            const size_t pixel = (begin + i) % nPixels;
+            samples->start(pixel, (begin + i) / nPixels);
+            paths.rays[i] = camera->getRay(pixel % width, pixel / width, *samples);
+            paths.beta[i] = Spectrum(1, 1, 1);
+            paths.path[i] = i;
+          }
+        }
+      });
+
+      for (size_t depth = maxDepth; depth > 0 && paths.size() > 0; depth--) {
+        const size_t m = paths.size();
+
+        timed(times, Extend, [&]() {
+          interacts.resize(m);
+          hit.resize(m);
+          scene.intersect(paths.rays.data(), m, interacts.data(), hit.data());
+        });
+
+        if (depth == maxDepth) {
+          // Primary hits go to the normal and depth AOVs
+          for (size_t i = 0; i < m; i++) {
+            if (!hit[i]) continue;
+            const size_t pixel = (begin + paths.path[i]) % nPixels;
+            normals[pixel] = interacts[i].n;
+            depths[pixel] = interacts[i].t;
+          }
+        }
+
+        // Hits grouped by material so that shading runs the same code (and
+        // touches the same data) for consecutive paths. Misses go first.
+        timed(times, Sort, [&]() {
+          // Scenes have few materials, a counting sort over their indices
+          std::vector<const IMaterial *> materials = {nullptr};
+          std::vector<uint32_t> bin(m);
+          uint32_t last = 0; // Consecutive paths often hit the same material
+          for (size_t i = 0; i < m; i++) {
+            const IMaterial *material = hit[i] ? interacts[i].material : nullptr;
+            if (material != materials[last]) {
+              auto it = std::find(materials.begin(), materials.end(), material);
+              if (it == materials.end()) it = materials.insert(it, material);
+              last = it - materials.begin();
+            }
+            bin[i] = last;
+          }
+
+          std::vector<uint32_t> first(materials.size() + 1, 0);
+          for (size_t i = 0; i < m; i++) first[bin[i] + 1]++;
+          for (size_t b = 1; b < first.size(); b++) first[b] += first[b - 1];
+
+          order.resize(m);
+          for (size_t i = 0; i < m; i++)
+            order[first[bin[i]]++] = i;
+        });
+
+        // Every path may continue (in place) and connect to every light
+        // (slot i * nLights + l), the queues are compacted afterwards
+        timed(times, Shade, [&]() {
+          alive.assign(m, false);
+          lit.assign(m * nLights, false);
+          next.resize(m); // Only the entries of surviving paths are written
+          shadow.resize(m * nLights);
+
+          #pragma omp parallel
+          {
+            const std::unique_ptr<Sampler> samples = makeSampler(samplerConfig);
+            #pragma omp for schedule(static, 64)
+            for (size_t k = 0; k < m; k++) {
+              const uint32_t i = order[k];
+              const uint32_t path = paths.path[i];
+              const Spectrum &beta = paths.beta[i];
+
+              if (!hit[i]) {
+                L[path] += beta * scene.envMapValue(paths.rays[i]);
+                continue;
+              }
+
+              const SurfaceInteraction &interact = interacts[i];
+              const Point x = interact.p;
+
+              const Spectrum Le = interact.material->Le();
+              if (Le.max() != 0) { // Material emits
+                L[path] += beta * Le;
+                continue;
+              }
+
+              samples->start((begin + path) % nPixels, (begin + path) / nPixels);
+              samples->startVertex(maxDepth - depth + 1);
+              const auto brdf = interact.material->sampleFr(interact, *samples);
+              if (brdf == nullptr) continue; // Absorption
+
+              // Light connections, as Scene::directLight
+              const Direction ns = (interact.entering) ? interact.n : -interact.n;
+              for (size_t l = 0; l < nLights; l++) {
+                const PointLight &light = scene.lights[l];
+                const Direction wi = (light.p - x).normalize();
+                const Float d2l = (light.p - x).norm();
+
+                if (wi.dot(ns) <= 0) continue; // Light is behind the surface
+
+                const size_t slot = i * nLights + l;
+                shadow.rays[slot] = Ray(x, wi, shadowEps, d2l - shadowEps);
+                shadow.L[slot] = beta * light.power / (d2l*d2l) * brdf->fr(interact, wi) * std::abs(ns.dot(wi));
+                shadow.path[slot] = path;
+                lit[slot] = true;
+              }
+
+              if (depth == 1) continue; // Li(depth 0) is black
+
+              Direction wi;
+              const Spectrum Fr = brdf->sampleFr(sampler, interact, wi, *samples);
+              const Float cosThetaI = brdf->cosThetaI(sampler, wi, interact.n);
+              const Float p = brdf->p(sampler, wi);
+
+              assert(Fr.min() >= 0, "Fr < 0, Physically based BRDFs are non-negative!");
+
+              next.beta[i] = beta * Fr * cosThetaI / p;
+              if (!rr.survives(maxDepth - depth + 1, next.beta[i], *samples)) continue;
+
+              next.rays[i] = Ray(x, wi, eps);
+              next.path[i] = path;
+              alive[i] = true;
+            }
+          }
+        });
+
+        timed(times, Connect, [&]() {
+          connect.compact(shadow, lit, slots);
+
+          occluded.resize(connect.size());
+          scene.intersectP(connect.rays.data(), connect.size(), occluded.data());
+          for (size_t i = 0; i < connect.size(); i++)
+            if (!occluded[i]) L[connect.path[i]] += connect.L[i];
+        });
+
+        paths.compact(next, alive, slots);
+      }
+
+      for (size_t i = 0; i < n; i++)
+        image[(begin + i) % nPixels] += L[i];
+
+      utils::Telemetry::addSamples(n);
+    }
+    telemetry.finish();
+
+    for (size_t i = 0; i < nPixels; i++) {
+      const size_t x = i % width, y = i / width;
+      camera->writeColor(x, y, image[i] / spp);
+      camera->writeNormal(x, y, normals[i]);
+      camera->writeDepth(x, y, depths[i]);
+    }
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+    std::cout << "[WAVEFRONT " << width << "x" << height << "px " << spp << "spp] render took: " << utils::time::format(duration) << std::endl;
+
+    const Seconds total = stop - start;
+    for (int stage = 0; stage < nStages; stage++) {
+      std::cout << "  " << std::left << std::setw(9) << stageNames[stage] << std::right
+                << std::fixed << std::setprecision(3) << std::setw(9) << times[stage].count() << " s"
+                << std::setprecision(1) << std::setw(7) << 100 * times[stage].count() / total.count() << "%" << std::endl;
+    }
+    std::cout << std::defaultfloat << std::endl;
+  }
+} // namespace wavefront
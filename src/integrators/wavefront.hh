@@ -0,0 +1,19 @@
+#ifndef WAVEFRONT_H_
+#define WAVEFRONT_H_
+
+#include "integrators/pathtracer.hh"
+#include "materials/slides.hh"
+#include "camera.hh"
+#include "scene.hh"
+#include <memory>
+
+// Same estimator as pathtracer, but instead of following one path at a time
+// all the paths of a wave advance together through separate stages:
+// generate camera rays, extend (closest hit), sort hits by material, shade
+// and sample, connect (shadow rays). Stages communicate through SoA queues.
+namespace wavefront {
+  void render(std::shared_ptr<Camera> &camera, const Scene &scene, size_t spp, size_t maxDepth, HemisphereSampler sampler = COSINE, const SamplerConfig &samplerConfig = SamplerConfig(),
+              const pathtracer::RussianRoulette &rr = pathtracer::RussianRoulette());
+} // namespace wavefront
+
+#endif // WAVEFRONT_H_
@@ -20,6 +20,17 @@ class Interaction {
 };
 
 class IMaterial; // Forward declaration to avoid circular dependency
+class Primitive;
+
+// Minimal hit data kept while traversing, the SurfaceInteraction is only
+// computed once for the closest hit (see Primitive::interaction)
+struct HitRecord {
+  Float t;
+  Float b1, b2; // Barycentric coordinates (triangles)
+  const Primitive *primitive = nullptr;
+  uint primID = 0; // Index inside the primitive, e.g. triangle of a mesh
+  const Primitive *object = nullptr; // Primitive hit inside an Instance
+};
 
 struct SurfaceInteraction { // TODO: Temporal
   Point p;
@@ -32,7 +43,7 @@ struct SurfaceInteraction { // TODO: Temporal
   Direction wo;
   bool entering;
   Float t;
-  std::shared_ptr<IMaterial> material;
+  const IMaterial *material = nullptr; // Owned by the primitive
 };
 
 #endif // INTERACTION_H_
@@ -1,9 +1,10 @@
 #include "material.hh"
 
-Direction randomHemisphereDirection(const Direction &n, HemisphereSampler sampler) {
-  const Float theta = (sampler == SOLID_ANGLE) ? std::acos(uniform(0, 1))
-                                  /* COSINE */ : std::acos(std::sqrt(1.0 - uniform(0, 1)));
-  const Float phi = 2.0 * M_PI * uniform(0, 1);
+Direction randomHemisphereDirection(const Direction &n, HemisphereSampler sampler, Sampler &samples) {
+  const Vec2 u = samples.get2D();
+  const Float theta = (sampler == SOLID_ANGLE) ? std::acos(u.x)
+                                  /* COSINE */ : std::acos(std::sqrt(1.0 - u.x));
+  const Float phi = 2.0 * M_PI * u.y;
 
   Direction x, y, z = n;
   makeCoordSystem(z, x, y); 
@@ -19,7 +20,7 @@ Direction reflect(const Direction &v, const Direction &n) {
   return v + n * 2 * cosI;
 }
 
-Direction refract(const Direction &v, const Direction &n, Float n1, Float n2) {
+Direction refract(const Direction &v, const Direction &n, Float n1, Float n2, Sampler &samples) {
 // Source: https://graphics.stanford.edu/courses/cs148-10-summer/docs/2006--degreve--reflection_refraction.pdf
 
   const Float eta = n1 / n2;
@@ -46,7 +47,7 @@ Direction refract(const Direction &v, const Direction &n, Float n1, Float n2) {
   const Float r = r0 + (1.0 - r0) * x * x * x * x * x; 
   #endif
 
-  if (uniform(0, 1) < r)
+  if (samples.get1D() < r)
     return v + n * 2 * cosI;
 
   return v * eta + n * (eta * cosI - cosT);
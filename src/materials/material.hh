@@ -5,6 +5,7 @@
 #include "geometry.hh"
 #include "spectrum.hh"
 #include "interaction.hh"
+#include "sampler.hh"
 
 enum HemisphereSampler {
   SOLID_ANGLE, COSINE
@@ -15,7 +16,7 @@ class BSDF {
     explicit BSDF(bool isDelta_) : isDelta{isDelta_} {}
 
     virtual Spectrum fr(const SurfaceInteraction &si, const Direction &wi) const = 0;
-    virtual Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi) const = 0;
+    virtual Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const = 0;
     virtual Float p(HemisphereSampler sampler, const Direction &wi) const = 0;
     virtual Float cosThetaI(HemisphereSampler sampler, const Direction &wi, const Direction &n) const = 0;
   
@@ -25,7 +26,7 @@ class BSDF {
 
 class IMaterial {
   public:
-    virtual std::shared_ptr<BSDF> sampleFr(const SurfaceInteraction &si) const = 0;
+    virtual std::shared_ptr<BSDF> sampleFr(const SurfaceInteraction &si, Sampler &samples) const = 0;
 
     virtual Spectrum Le() const = 0;
 };
@@ -34,12 +35,13 @@ class IMaterial {
 // Helper functions:
 
 // Returns a random direction in the hemisphere
-Direction randomHemisphereDirection(const Direction &n, HemisphereSampler sampler);
+Direction randomHemisphereDirection(const Direction &n, HemisphereSampler sampler, Sampler &samples);
 
 // Returns the reflected direction
 Direction reflect(const Direction &v, const Direction &n);
 
-// Returns the refracted direction
-Direction refract(const Direction &v, const Direction &n, Float n1, Float n2);
+// Returns the refracted direction, or the reflected one with the Fresnel
+// reflectance as probability
+Direction refract(const Direction &v, const Direction &n, Float n1, Float n2, Sampler &samples);
 
 #endif // MATERIAL_H_
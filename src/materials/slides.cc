@@ -8,12 +8,12 @@ namespace Slides {
     return k;// M_1_PI gets cancelled out
   }
 
-  ::Spectrum DiffuseBRDF::sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi) const {
+  ::Spectrum DiffuseBRDF::sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const {
   // (Page: 11) https://moodle.unizar.es/add/pluginfile.php/9116118/mod_label/intro/ig_practica_8.pdf?time=1698147710097
 
     const Direction n = (si.entering) ? si.n : -si.n; // TODO: !!!!
 
-    wi = randomHemisphereDirection(n, sampler);
+    wi = randomHemisphereDirection(n, sampler, samples);
 
     return k * invProb; // * M_1_PI; gets cancelled out     <--
   }
@@ -38,7 +38,7 @@ namespace Slides {
     return Spectrum(); // Delta function
   }
 
-  ::Spectrum PerfectSpecularBRDF::sampleFr(HemisphereSampler /*sampler*/, const SurfaceInteraction &si, Direction &wi) const {
+  ::Spectrum PerfectSpecularBRDF::sampleFr(HemisphereSampler /*sampler*/, const SurfaceInteraction &si, Direction &wi, Sampler &/*samples*/) const {
     const Direction n = (si.entering) ? si.n : -si.n;
 
     wi = reflect(-si.wo, n);
@@ -62,13 +62,13 @@ namespace Slides {
     return Spectrum(); // Delta function
   }
 
-  ::Spectrum RefractionBRDF::sampleFr(HemisphereSampler /*sampler*/, const SurfaceInteraction &si, Direction &wi) const {
+  ::Spectrum RefractionBRDF::sampleFr(HemisphereSampler /*sampler*/, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const {
     const Float n1 = si.entering ? 1.0 : 1.5; // TODO: change to variable
     const Float n2 = si.entering ? 1.5 : 1.0;
 
     const Direction n = (si.entering) ? si.n : -si.n;
 
-    wi = refract(-si.wo, n, n1, n2);
+    wi = refract(-si.wo, n, n1, n2, samples);
 
     return k * invProb; // / wi.dot(n) ; gets cancelled out     <--
   }
@@ -94,8 +94,8 @@ namespace Slides {
     refraction = std::make_shared<RefractionBRDF>(kt, prob_t);
   }
 
-  std::shared_ptr<BSDF> Material::sampleFr(const SurfaceInteraction &/*si*/) const {
-    const Float sample = uniform(0, 1);
+  std::shared_ptr<BSDF> Material::sampleFr(const SurfaceInteraction &/*si*/, Sampler &samples) const {
+    const Float sample = samples.get1D();
 
     if (sample < prob_d) {
       return diffuse;
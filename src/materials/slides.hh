@@ -9,7 +9,7 @@ namespace Slides { // BSDFs & Materials as seen in class (Fall 2023) (Unizar, Gr
       DiffuseBRDF(const ::Spectrum &coefficient, Float prob = 1.0);
 
       ::Spectrum fr(const SurfaceInteraction &si, const Direction &wi) const override;
-      ::Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi) const override;
+      ::Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const override;
       Float p(HemisphereSampler sampler, const Direction &wi) const override;
       Float cosThetaI(HemisphereSampler sampler, const Direction &wi, const Direction &n) const override;
 
@@ -23,7 +23,7 @@ namespace Slides { // BSDFs & Materials as seen in class (Fall 2023) (Unizar, Gr
       PerfectSpecularBRDF(const ::Spectrum &coefficient, Float prob = 1.0);
 
       ::Spectrum fr(const SurfaceInteraction &si, const Direction &wi) const override;
-      ::Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi) const override;
+      ::Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const override;
       Float p(HemisphereSampler sampler, const Direction &wi) const override;
       Float cosThetaI(HemisphereSampler sampler, const Direction &wi, const Direction &n) const override;
 
@@ -37,7 +37,7 @@ namespace Slides { // BSDFs & Materials as seen in class (Fall 2023) (Unizar, Gr
       RefractionBRDF(const ::Spectrum &coefficient, Float prob = 1.0);
 
       ::Spectrum fr(const SurfaceInteraction &si, const Direction &wi) const override;
-      ::Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi) const override;
+      ::Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const override;
       Float p(HemisphereSampler sampler, const Direction &wi) const override;
       Float cosThetaI(HemisphereSampler sampler, const Direction &wi, const Direction &n) const override;
 
@@ -51,7 +51,7 @@ namespace Slides { // BSDFs & Materials as seen in class (Fall 2023) (Unizar, Gr
       Material(const ::Spectrum &kd, const ::Spectrum &ks, const ::Spectrum &kt, const ::Spectrum &ke,
               Float eta_ = 1.0);
 
-      std::shared_ptr<BSDF> sampleFr(const SurfaceInteraction &si) const override;
+      std::shared_ptr<BSDF> sampleFr(const SurfaceInteraction &si, Sampler &samples) const override;
 
       Spectrum Le() const override;
 
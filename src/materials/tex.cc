@@ -8,12 +8,12 @@ namespace tex {
     return k->value(si); // M_1_PI gets cancelled out
   }
 
-  Spectrum DiffuseBRDF::sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi) const {
+  Spectrum DiffuseBRDF::sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const {
   // (Page: 11) https://moodle.unizar.es/add/pluginfile.php/9116118/mod_label/intro/ig_practica_8.pdf?time=1698147710097
 
     const Direction n = (si.entering) ? si.n : -si.n; // TODO: !!!!
 
-    wi = randomHemisphereDirection(n, sampler);
+    wi = randomHemisphereDirection(n, sampler, samples);
 
     return k->value(si); // * M_1_PI; gets cancelled out     <--
   }
@@ -37,7 +37,7 @@ namespace tex {
     return Spectrum(); // Delta function
   }
 
-  Spectrum PerfectSpecularBRDF::sampleFr(HemisphereSampler /*sampler*/, const SurfaceInteraction &si, Direction &wi) const {
+  Spectrum PerfectSpecularBRDF::sampleFr(HemisphereSampler /*sampler*/, const SurfaceInteraction &si, Direction &wi, Sampler &/*samples*/) const {
     const Direction n = (si.entering) ? si.n : -si.n;
 
     wi = reflect(-si.wo, n);
@@ -60,13 +60,13 @@ namespace tex {
     return Spectrum(); // Delta function
   }
 
-  Spectrum RefractionBRDF::sampleFr(HemisphereSampler /*sampler*/, const SurfaceInteraction &si, Direction &wi) const {
+  Spectrum RefractionBRDF::sampleFr(HemisphereSampler /*sampler*/, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const {
     const Float n1 = si.entering ? 1.0 : 1.5; // TODO: change to variable
     const Float n2 = si.entering ? 1.5 : 1.0;
 
     const Direction n = (si.entering) ? si.n : -si.n;
 
-    wi = refract(-si.wo, n, n1, n2);
+    wi = refract(-si.wo, n, n1, n2, samples);
 
     return k->value(si); // / wi.dot(n) ; gets cancelled out      <--
   }
@@ -86,8 +86,8 @@ namespace tex {
     return bsdf->fr(si, wi);
   }
 
-  Spectrum SampledBSDF::sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi) const {
-    return bsdf->sampleFr(sampler, si, wi) * invProb;
+  Spectrum SampledBSDF::sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const {
+    return bsdf->sampleFr(sampler, si, wi, samples) * invProb;
   }
 
   Float SampledBSDF::p(HemisphereSampler sampler, const Direction &wi) const {
@@ -113,8 +113,8 @@ namespace tex {
     // TODO: review 
   }
 
-  std::shared_ptr<BSDF> Material::sampleFr(const SurfaceInteraction &si) const {
-    const Float sample = uniform(0, 1);
+  std::shared_ptr<BSDF> Material::sampleFr(const SurfaceInteraction &si, Sampler &samples) const {
+    const Float sample = samples.get1D();
 
     assert(
       (diffuse->k->value(si) + specular->k->value(si) + refraction->k->value(si)).max() <= 1,
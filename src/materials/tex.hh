@@ -10,7 +10,7 @@ namespace tex { // Texture-based materials
       explicit DiffuseBRDF(const std::shared_ptr<Texture> &coefficient);
 
       Spectrum fr(const SurfaceInteraction &si, const Direction &wi) const override;
-      Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi) const override;
+      Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const override;
       Float p(HemisphereSampler sampler, const Direction &wi) const override;
       Float cosThetaI(HemisphereSampler sampler, const Direction &wi, const Direction &n) const override;
 
@@ -25,7 +25,7 @@ namespace tex { // Texture-based materials
       explicit PerfectSpecularBRDF(const std::shared_ptr<Texture> &coefficient);
 
       Spectrum fr(const SurfaceInteraction &si, const Direction &wi) const override;
-      Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi) const override;
+      Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const override;
       Float p(HemisphereSampler sampler, const Direction &wi) const override;
       Float cosThetaI(HemisphereSampler sampler, const Direction &wi, const Direction &n) const override;
 
@@ -40,7 +40,7 @@ namespace tex { // Texture-based materials
       explicit RefractionBRDF(const std::shared_ptr<Texture> &coefficient);
 
       Spectrum fr(const SurfaceInteraction &si, const Direction &wi) const override;
-      Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi) const override;
+      Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const override;
       Float p(HemisphereSampler sampler, const Direction &wi) const override;
       Float cosThetaI(HemisphereSampler sampler, const Direction &wi, const Direction &n) const override;
 
@@ -56,7 +56,7 @@ namespace tex { // Texture-based materials
       SampledBSDF(const std::shared_ptr<BSDF> &bsdf_, Float prob);
 
       Spectrum fr(const SurfaceInteraction &si, const Direction &wi) const override;
-      Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi) const override;
+      Spectrum sampleFr(HemisphereSampler sampler, const SurfaceInteraction &si, Direction &wi, Sampler &samples) const override;
       Float p(HemisphereSampler sampler, const Direction &wi) const override;
       Float cosThetaI(HemisphereSampler sampler, const Direction &wi, const Direction &n) const override;
 
@@ -71,7 +71,7 @@ namespace tex { // Texture-based materials
               const Spectrum &ke = Spectrum(0.0, 0.0, 0.0),
               Float eta_ = 1.0);
 
-      std::shared_ptr<BSDF> sampleFr(const SurfaceInteraction &si) const override;
+      std::shared_ptr<BSDF> sampleFr(const SurfaceInteraction &si, Sampler &samples) const override;
 
       Spectrum Le() const override;
 
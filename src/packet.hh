@@ -0,0 +1,112 @@
+#ifndef PACKET_H_
+#define PACKET_H_
+
+#include "ver.hh"
+#include "geometry.hh"
+
+#if defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+// Coherent rays (camera rays of a 4x4 pixel block) traced together, so that
+// every BVH node is fetched once for all of them
+constexpr int packetSize = 16;
+
+// Up to packetSize rays, lane i is in use if bit i of mask is set. Rays are
+// also kept in SoA form for the SIMD box tests, tMax[i] must follow
+// rays[i].tMax as hits are found (see shrink).
+struct RayPacket {
+  // The SIMD box tests load every lane of a group, unused lanes get an
+  // empty [tMin, tMax] so that they read defined values and never hit
+  RayPacket() : mask{0} {
+    for (int lane = 0; lane < packetSize; lane++) {
+      for (int a = 0; a < 3; a++) {
+        o[a][lane] = 0;
+        invDir[a][lane] = 0;
+      }
+      tMin[lane] = std::numeric_limits<float>::infinity();
+      tMax[lane] = -std::numeric_limits<float>::infinity();
+    }
+  }
+
+  void set(int lane, const Ray &ray) {
+    rays[lane] = ray;
+    for (int a = 0; a < 3; a++) {
+      o[a][lane] = static_cast<float>(ray.o[a]);
+      invDir[a][lane] = static_cast<float>(1.0 / ray.d[a]);
+    }
+    tMin[lane] = static_cast<float>(ray.tMin);
+    tMax[lane] = static_cast<float>(ray.tMax);
+    mask |= 1u << lane;
+  }
+
+  // Call after rays[lane].tMax has been shrunk by a closest-hit query
+  void shrink(int lane) { tMax[lane] = static_cast<float>(rays[lane].tMax); }
+
+  // Returns the lanes among the given ones whose ray hits b within its
+  // [tMin, tMax], same test as Bounds::intersect
+  uint32_t intersect(const Bounds &b, uint32_t lanes) const {
+    constexpr float robust = 1 + 2 * gamma(3);
+    uint32_t hit = 0;
+#if defined(__SSE__)
+    for (int g = 0; g < packetSize; g += 4) {
+      if (((lanes >> g) & 0xF) == 0) continue;
+
+      __m128 t0 = _mm_load_ps(tMin + g);
+      __m128 t1 = _mm_load_ps(tMax + g);
+      for (int a = 0; a < 3; a++) {
+        const __m128 inv = _mm_load_ps(invDir[a] + g);
+        const __m128 org = _mm_load_ps(o[a] + g);
+        const __m128 lo = _mm_set1_ps(static_cast<float>(b.min[a]));
+        const __m128 hi = _mm_set1_ps(static_cast<float>(b.max[a]));
+
+        // Near and far planes per lane depending on the sign of the direction
+        const __m128 neg = _mm_cmplt_ps(inv, _mm_setzero_ps());
+        const __m128 near = _mm_or_ps(_mm_and_ps(neg, hi), _mm_andnot_ps(neg, lo));
+        const __m128 far = _mm_or_ps(_mm_and_ps(neg, lo), _mm_andnot_ps(neg, hi));
+
+        const __m128 tn = _mm_mul_ps(_mm_sub_ps(near, org), inv);
+        const __m128 tf = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(far, org), inv), _mm_set1_ps(robust));
+
+        // Operand order matters: NaNs (0 * inf) leave t0/t1 untouched
+        t0 = _mm_max_ps(tn, t0);
+        t1 = _mm_min_ps(tf, t1);
+      }
+      hit |= static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(t0, t1))) << g;
+    }
+#else
+    for (int i = 0; i < packetSize; i++) {
+      if (!(lanes & (1u << i))) continue;
+
+      float t0 = tMin[i], t1 = tMax[i];
+      for (int a = 0; a < 3; a++) {
+        const bool neg = invDir[a][i] < 0;
+        const float near = static_cast<float>(neg ? b.max[a] : b.min[a]);
+        const float far = static_cast<float>(neg ? b.min[a] : b.max[a]);
+        const float tn = (near - o[a][i]) * invDir[a][i];
+        const float tf = (far - o[a][i]) * invDir[a][i] * robust;
+        t0 = tn > t0 ? tn : t0;
+        t1 = tf < t1 ? tf : t1;
+      }
+      if (t0 <= t1) hit |= 1u << i;
+    }
+#endif
+    return hit & lanes;
+  }
+
+  Ray rays[packetSize];
+  alignas(16) float o[3][packetSize];
+  alignas(16) float invDir[3][packetSize];
+  alignas(16) float tMin[packetSize];
+  alignas(16) float tMax[packetSize];
+  uint32_t mask;
+};
+
+// Index of the lowest lane set in a non-empty mask
+inline int firstLane(uint32_t lanes) {
+  int i = 0;
+  while (!(lanes & (1u << i))) i++;
+  return i;
+}
+
+#endif // PACKET_H_
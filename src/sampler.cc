@@ -0,0 +1,143 @@
+#include "sampler.hh"
+#include <stdexcept>
+
+namespace {
+  uint32_t reverseBits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+  }
+
+  // Second dimension of Sobol's sequence, the first one is reverseBits
+  uint32_t sobol1(uint32_t index) {
+    uint32_t x = 0;
+    for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1)
+      if (index & 1) x ^= v;
+    return x;
+  }
+
+  // Hash that only mixes each bit with the bits below it (Burley 2020)
+  uint32_t laineKarras(uint32_t x, uint32_t seed) {
+    x += seed;
+    x ^= x * 0x6c50b47cu;
+    x ^= x * 0xb82f1e52u;
+    x ^= x * 0xc7afe638u;
+    x ^= x * 0x8d22f6e6u;
+    return x;
+  }
+
+  // Owen scrambling of a base 2 fraction: each bit is flipped depending on
+  // the ones above it
+  uint32_t owenScramble(uint32_t x, uint32_t seed) { return reverseBits(laineKarras(reverseBits(x), seed)); }
+
+  // Element i of a random permutation of [0, n) given by p (Kensler 2013)
+  uint32_t permutationElement(uint32_t i, uint32_t n, uint32_t p) {
+    uint32_t w = n - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+      i ^= p;
+      i *= 0xe170893d;
+      i ^= p >> 16;
+      i ^= (i & w) >> 4;
+      i ^= p >> 8;
+      i *= 0x0929eb3f;
+      i ^= p >> 23;
+      i ^= (i & w) >> 1;
+      i *= 1 | p >> 27;
+      i *= 0x6935fa69;
+      i ^= (i & w) >> 11;
+      i *= 0x74dcb303;
+      i ^= (i & w) >> 2;
+      i *= 0x9e501cc3;
+      i ^= (i & w) >> 2;
+      i *= 0xc860a3df;
+      i &= w;
+      i ^= i >> 5;
+    } while (i >= n);
+    return (i + p) % n;
+  }
+
+  constexpr uint32_t primes[] = {
+    2,   3,   5,   7,   11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,  53,
+    59,  61,  67,  71,  73,  79,  83,  89,  97,  101, 103, 107, 109, 113, 127, 131,
+    137, 139, 149, 151, 157, 163, 167, 173, 179, 181, 191, 193, 197, 199, 211, 223,
+    227, 229, 233, 239, 241, 251, 257, 263, 269, 271, 277, 281, 283, 293, 307, 311,
+  };
+  constexpr uint32_t nPrimes = sizeof(primes) / sizeof(primes[0]);
+} // namespace
+
+Float IndependentSampler::sample1D(uint32_t dim) const {
+  return toFloat(mix(dimensionKey(dim) ^ index) >> 32);
+}
+
+Vec2 IndependentSampler::sample2D(uint32_t dim) const {
+  const uint64_t h = mix(dimensionKey(dim) ^ index);
+  return Vec2(toFloat(h >> 32), toFloat(static_cast<uint32_t>(h)));
+}
+
+Float SobolSampler::sample1D(uint32_t dim) const {
+  const uint64_t h = dimensionKey(dim);
+  const uint32_t i = owenScramble(static_cast<uint32_t>(index), static_cast<uint32_t>(h));
+  return toFloat(owenScramble(reverseBits(i), h >> 32));
+}
+
+Vec2 SobolSampler::sample2D(uint32_t dim) const {
+  const uint64_t h = dimensionKey(dim);
+  const uint64_t h2 = mix(h);
+  const uint32_t i = owenScramble(static_cast<uint32_t>(index), static_cast<uint32_t>(h));
+  return Vec2(toFloat(owenScramble(reverseBits(i), h >> 32)),
+              toFloat(owenScramble(sobol1(i), static_cast<uint32_t>(h2))));
+}
+
+// Each digit goes through a random permutation chosen by the ones before it.
+// Past the last digit of index the scrambled digits are independent and
+// uniform, so they are replaced by a single uniform number.
+Float HaltonSampler::radicalInverse(uint32_t base, uint64_t index, uint64_t seed) {
+  const Float invBase = static_cast<Float>(1) / base;
+  Float invBaseM = 1;
+  Float value = 0;
+  uint64_t prefix = 0; // Scrambled digits so far, identifies the node
+  while (index > 0) {
+    const uint64_t next = index / base;
+    const uint32_t digit = index - next * base;
+    const uint32_t scrambled = permutationElement(digit, base, static_cast<uint32_t>(mix(seed ^ prefix)));
+    prefix = prefix * base + scrambled + 1;
+    invBaseM *= invBase;
+    value += scrambled * invBaseM;
+    index = next;
+  }
+  value += invBaseM * toFloat(mix(seed ^ prefix) >> 32);
+  return std::min<Float>(value, 1 - std::numeric_limits<Float>::epsilon() / 2);
+}
+
+Float HaltonSampler::sample1D(uint32_t dim) const {
+  const uint64_t h = dimensionKey(dim);
+  if (2 * dim >= nPrimes) return toFloat(mix(h ^ index) >> 32);
+  return radicalInverse(primes[2 * dim], index, h);
+}
+
+Vec2 HaltonSampler::sample2D(uint32_t dim) const {
+  const uint64_t h = dimensionKey(dim);
+  if (2 * dim + 1 >= nPrimes) {
+    const uint64_t r = mix(h ^ index);
+    return Vec2(toFloat(r >> 32), toFloat(static_cast<uint32_t>(r)));
+  }
+  return Vec2(radicalInverse(primes[2 * dim], index, h),
+              radicalInverse(primes[2 * dim + 1], index, mix(h)));
+}
+
+std::unique_ptr<Sampler> makeSampler(const SamplerConfig &config) {
+  switch (config.sequence) {
+    case SampleSequence::Independent: return std::make_unique<IndependentSampler>(config.seed);
+    case SampleSequence::Sobol:       return std::make_unique<SobolSampler>(config.seed);
+    case SampleSequence::Halton:      return std::make_unique<HaltonSampler>(config.seed);
+  }
+  throw std::runtime_error("Unknown sample sequence");
+}
@@ -0,0 +1,109 @@
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+#include "ver.hh"
+#include "geometry.hh"
+#include <memory>
+
+enum class SampleSequence { Independent, Sobol, Halton };
+
+struct SamplerConfig {
+  SampleSequence sequence = SampleSequence::Sobol;
+  uint seed = 5489u;
+};
+
+// Random numbers of the paths. start() selects sample index of pixel (any
+// key, photons use one no pixel has) and get1D/get2D hand out its dimensions
+// in order, every call is one dimension whatever its size. Each path vertex
+// has its own block of dimensions (startVertex), so the same decision of
+// every sample of a pixel, say the lobe of the second bounce, always uses the
+// same dimension and is stratified over the samples.
+// Values only depend on (seed, pixel, index, dimension): the same seed gives
+// the same image whatever the thread count or the tile order.
+class Sampler {
+  public:
+    // Lobe, direction, Russian roulette and a spare
+    static constexpr uint32_t dimensionsPerVertex = 4;
+
+    explicit Sampler(uint seed_) : seed{seed_}, pixelKey{0}, index{0}, dimension{0} {}
+    virtual ~Sampler() = default;
+    virtual std::unique_ptr<Sampler> clone() const = 0;
+
+    void start(uint64_t pixel, uint64_t index_) {
+      pixelKey = mix(mix(seed) ^ pixel);
+      index = index_;
+      dimension = 0;
+    }
+    // Vertex 0 is the camera, vertex n the n-th bounce
+    void startVertex(size_t vertex) { dimension = vertex * dimensionsPerVertex; }
+
+    Float get1D() { return sample1D(dimension++); }
+    Vec2 get2D() { return sample2D(dimension++); }
+
+  protected:
+    virtual Float sample1D(uint32_t dim) const = 0;
+    virtual Vec2 sample2D(uint32_t dim) const = 0;
+
+    // SplitMix64 finalizer
+    static uint64_t mix(uint64_t z) {
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+    }
+    // Key of a dimension of the pixel
+    uint64_t dimensionKey(uint32_t dim) const { return mix(pixelKey + (dim + 1) * 0x9e3779b97f4a7c15ull); }
+    // [0, 1) from the 24 high bits, so that it never rounds up to 1 as a float
+    static Float toFloat(uint32_t bits) { return (bits >> 8) * static_cast<Float>(1.0 / (1u << 24)); }
+
+    uint64_t seed;
+    uint64_t pixelKey; // Hash of the seed and the pixel
+    uint64_t index;    // Sample of the pixel
+    uint32_t dimension;
+};
+
+// Uncorrelated numbers, a hash of (seed, pixel, index, dimension)
+class IndependentSampler : public Sampler {
+  public:
+    using Sampler::Sampler;
+    std::unique_ptr<Sampler> clone() const override { return std::make_unique<IndependentSampler>(*this); }
+
+  protected:
+    Float sample1D(uint32_t dim) const override;
+    Vec2 sample2D(uint32_t dim) const override;
+};
+
+// Owen-scrambled Sobol (Burley, Practical Hash-based Owen Scrambling, 2020):
+// every dimension is the first one or the first two of Sobol's sequence,
+// with the sample index shuffled and the values scrambled by a hash of the
+// pixel and the dimension, so any number of dimensions is stratified and
+// they are decorrelated from one another.
+class SobolSampler : public Sampler {
+  public:
+    using Sampler::Sampler;
+    std::unique_ptr<Sampler> clone() const override { return std::make_unique<SobolSampler>(*this); }
+
+  protected:
+    Float sample1D(uint32_t dim) const override;
+    Vec2 sample2D(uint32_t dim) const override;
+};
+
+// Halton's sequence with Owen-scrambled digits, per pixel. Dimension d uses
+// the primes 2d and 2d + 1 as bases, past the table (deep vertices) the
+// numbers are independent.
+class HaltonSampler : public Sampler {
+  public:
+    using Sampler::Sampler;
+    std::unique_ptr<Sampler> clone() const override { return std::make_unique<HaltonSampler>(*this); }
+
+  protected:
+    Float sample1D(uint32_t dim) const override;
+    Vec2 sample2D(uint32_t dim) const override;
+
+  private:
+    // Owen-scrambled radical inverse of index in the given base
+    static Float radicalInverse(uint32_t base, uint64_t index, uint64_t seed);
+};
+
+std::unique_ptr<Sampler> makeSampler(const SamplerConfig &config);
+
+#endif // SAMPLER_H_
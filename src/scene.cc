@@ -0,0 +1,82 @@
+#include "scene.hh"
+
+namespace {
+  // Spreads the lower 10 bits of x so that there are two zeros between bits
+  uint32_t expandBits(uint32_t x) {
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x <<  8)) & 0x0300F00F;
+    x = (x | (x <<  4)) & 0x030C30C3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+  }
+
+  // Order in which a stream is traced: rays are grouped by the octant of
+  // their direction, then follow a Morton curve over the bounds of their
+  // origins, so consecutive rays tend to visit the same nodes
+  std::vector<uint32_t> coherentOrder(const Ray *rays, size_t n) {
+    Bounds origins;
+    for (size_t i = 0; i < n; i++)
+      origins = origins.Union(rays[i].o);
+
+    std::vector<std::pair<uint64_t, uint32_t>> keys(n);
+    #pragma omp parallel for if (n > 4096)
+    for (size_t i = 0; i < n; i++) {
+      const Direction o = origins.offset(rays[i].o);
+      uint32_t morton = 0;
+      for (int a = 0; a < 3; a++) {
+        const uint32_t q = std::min(1023.0f, std::max(0.0f, static_cast<float>(o[a]) * 1024));
+        morton |= expandBits(q) << a;
+      }
+      const uint64_t octant = (rays[i].d.x < 0) | (rays[i].d.y < 0) << 1 | (rays[i].d.z < 0) << 2;
+      keys[i] = {octant << 30 | morton, static_cast<uint32_t>(i)};
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; i++)
+      order[i] = keys[i].second;
+    return order;
+  }
+} // namespace
+
+void Scene::intersect(const Ray *rays, size_t n, SurfaceInteraction *interacts, uint8_t *hit) const {
+  const std::vector<uint32_t> order = coherentOrder(rays, n);
+  const size_t nPackets = (n + packetSize - 1) / packetSize;
+
+  #pragma omp parallel for schedule(dynamic, 16) if (nPackets > 1)
+  for (size_t p = 0; p < nPackets; p++) {
+    const size_t first = p * packetSize;
+    const size_t count = std::min(n - first, static_cast<size_t>(packetSize));
+
+    RayPacket packet;
+    for (size_t k = 0; k < count; k++)
+      packet.set(k, rays[order[first + k]]);
+
+    SurfaceInteraction packetInteracts[packetSize];
+    const uint32_t hits = intersect(packet, packetInteracts);
+    for (size_t k = 0; k < count; k++) {
+      const uint32_t i = order[first + k];
+      hit[i] = (hits >> k) & 1;
+      if (hit[i]) interacts[i] = packetInteracts[k];
+    }
+  }
+}
+
+void Scene::intersectP(const Ray *rays, size_t n, uint8_t *occluded) const {
+  const std::vector<uint32_t> order = coherentOrder(rays, n);
+  const size_t nPackets = (n + packetSize - 1) / packetSize;
+
+  #pragma omp parallel for schedule(dynamic, 16) if (nPackets > 1)
+  for (size_t p = 0; p < nPackets; p++) {
+    const size_t first = p * packetSize;
+    const size_t count = std::min(n - first, static_cast<size_t>(packetSize));
+
+    RayPacket packet;
+    for (size_t k = 0; k < count; k++)
+      packet.set(k, rays[order[first + k]]);
+
+    const uint32_t blocked = intersectP(packet);
+    for (size_t k = 0; k < count; k++)
+      occluded[order[first + k]] = (blocked >> k) & 1;
+  }
+}
@@ -8,9 +8,14 @@
 #include "shapes/primitive.hh"
 #include "spectrum.hh"
 #include "accelerators/bvh.hh"
+#include "accelerators/wbvh.hh"
+#include "shapes/instance.hh"
+#include "shapes/mesh.hh"
 #include "camera.hh"
 #include "texture.hh"
 #include "materials/material.hh"
+#include "utils/telemetry.hh"
+#include <bitset>
 #include <vector>
 
 class EnvironmentMap { // TODO: Review
@@ -35,28 +40,70 @@ class EnvironmentMap { // TODO: Review
 
 class Scene {
   public:
-    Scene() : scene{}, lights{}, envMap(nullptr), camera{nullptr} {};
+    Scene() : scene{}, instances{}, meshes{}, lights{}, envMap(nullptr), camera{nullptr}, accel{nullptr} {};
 
     bool intersect(const Ray &r, SurfaceInteraction &interact) const {
-      SurfaceInteraction surfInt, tmpSurfInt;
-      surfInt.t = std::numeric_limits<Float>::max();
-      tmpSurfInt.t = std::numeric_limits<Float>::max();
-      bool hit = false;
+      utils::Telemetry::addRays(1);
+      const Ray ray = r; // Primitives shrink tMax, keep the caller's ray intact
+      HitRecord hit;
 
-      for (const auto &primitive : scene) {
-        if (primitive->intersect(r, tmpSurfInt))
-          if (tmpSurfInt.t < surfInt.t) {
-            hit = true;
-            surfInt = tmpSurfInt;
-          }
+      for (const auto &primitive : scene)
+        primitive->intersect(ray, hit);
+
+      if (hit.primitive == nullptr) return false;
+
+      // Shading data is only computed for the closest hit
+      hit.primitive->interaction(r, hit, interact);
+      return true;
+    }
+
+    // Packet version of intersect, returns the lanes that hit something and
+    // fills interacts only for those
+    uint32_t intersect(const RayPacket &p, SurfaceInteraction interacts[]) const {
+      utils::Telemetry::addRays(std::bitset<32>(p.mask).count());
+      RayPacket packet = p;
+      HitRecord hits[packetSize];
+
+      for (const auto &primitive : scene)
+        primitive->intersectPacket(packet, packet.mask, hits);
+
+      uint32_t hitMask = 0;
+      for (int i = 0; i < packetSize; i++) {
+        if (hits[i].primitive == nullptr) continue;
+        hits[i].primitive->interaction(p.rays[i], hits[i], interacts[i]);
+        hitMask |= 1u << i;
       }
+      return hitMask;
+    }
+
+    // Returns true if anything blocks the ray within [r.tMin, r.tMax]
+    bool intersectP(const Ray &r) const {
+      utils::Telemetry::addRays(1);
+      for (const auto &primitive : scene)
+        if (primitive->intersectP(r))
+          return true;
 
-      if (hit)
-        interact = surfInt;
+      return false;
+    }
 
-      return hit;
+    // Packet version of intersectP, returns the lanes that are blocked
+    uint32_t intersectP(const RayPacket &packet) const {
+      utils::Telemetry::addRays(std::bitset<32>(packet.mask).count());
+      uint32_t blocked = 0;
+      for (const auto &primitive : scene) {
+        blocked |= primitive->intersectPPacket(packet, packet.mask & ~blocked);
+        if (blocked == packet.mask) break;
+      }
+      return blocked;
     }
 
+    // Stream versions for n rays at once: hit[i] (occluded[i]) is the result
+    // for rays[i], interacts[i] is only filled on hit. Rays are ordered by
+    // direction octant and origin and traced as packets in that order, in
+    // parallel.
+    void intersect(const Ray *rays, size_t n, SurfaceInteraction *interacts, uint8_t *hit) const;
+    void intersectP(const Ray *rays, size_t n, uint8_t *occluded) const;
+
     Spectrum directLight(const SurfaceInteraction &interact, const std::shared_ptr<BSDF> bsdf) const {
       constexpr Float eps = 5e-4;
 
@@ -70,26 +117,28 @@ class Scene {
 
         if (wi.dot(n) <= 0) continue; // Light is behind the surface
 
-        SurfaceInteraction interact2;
-        if (intersect(Ray(x + wi * eps, wi), interact2)) {
-          if (interact2.t > d2l - eps) {
-            L += light.power / (d2l*d2l) * bsdf->fr(interact, wi) * std::abs(n.dot(wi));
-          }
-        } else {
+        if (!intersectP(Ray(x, wi, eps, d2l - eps)))
           L += light.power / (d2l*d2l) * bsdf->fr(interact, wi) * std::abs(n.dot(wi));
-        }
       }
 
       return L;
     }
 
     void add(std::unique_ptr<Primitive> primitive) { scene.push_back(std::move(primitive)); }
+    void add(std::unique_ptr<Instance> instance) {
+      instances.push_back(instance.get());
+      scene.push_back(std::move(instance));
+    }
+    void add(std::unique_ptr<TriangleMeshPrimitive> mesh) {
+      meshes.push_back(mesh.get());
+      scene.push_back(std::move(mesh));
+    }
     void add(const PointLight &light) { lights.push_back(light); }
 
     void set(const std::shared_ptr<Texture> &env) { envMap = EnvironmentMap(env); }
     void set(const std::shared_ptr<Camera> &cam) { camera = cam; }
 
-    void makeBVH() {
+    void makeBVH(const BVHConfig &config = BVHConfig()) {
       std::vector<std::shared_ptr<Primitive>> p(scene.size());
 
       for (size_t i = 0; i < scene.size(); i++)
@@ -97,7 +146,30 @@ class Scene {
       
       scene.clear();
 
-      scene.push_back(std::make_unique<BVH>(std::move(p)));
+      std::unique_ptr<Aggregate> bvh;
+      if (config.width == 8)
+        bvh = std::make_unique<BVH8>(std::move(p), config);
+      else if (config.width == 4)
+        bvh = std::make_unique<BVH4>(std::move(p), config);
+      else
+        bvh = std::make_unique<BVH>(std::move(p), config);
+
+      accel = bvh.get();
+      scene.push_back(std::move(bvh));
+    }
+
+    // Call after moving instances (Instance::setTransform), refits the BVH
+    // or rebuilds it if it got too bad. Returns true if it was rebuilt.
+    bool updateBVH() { return (accel != nullptr) ? accel->update() : false; }
+
+    // Statistics of the top-level BVH, and of the BVHs of all the meshes
+    // added to the scene merged together
+    BVHStats bvhStats() const { return (accel != nullptr) ? accel->stats() : BVHStats(); }
+    BVHStats meshStats(const BVHConfig &config = BVHConfig()) const {
+      BVHStats stats;
+      for (const TriangleMeshPrimitive *mesh : meshes)
+        stats += mesh->stats(config);
+      return stats;
     }
 
     Spectrum envMapValue(const Ray &r) const {
@@ -106,9 +178,14 @@ class Scene {
 
   public:
     std::vector<std::unique_ptr<Primitive>> scene;
+    std::vector<Instance *> instances; // Owned by scene (or the BVH)
+    std::vector<TriangleMeshPrimitive *> meshes; // Owned by scene (or the BVH)
     std::vector<PointLight> lights;
     EnvironmentMap envMap;
     std::shared_ptr<Camera> camera;
+
+  private:
+    Aggregate *accel; // Top-level BVH built by makeBVH
 };
 
 #endif // SCENE_H_
@@ -7,6 +7,9 @@
 #include "shapes/sphere.hh"
 #include "shapes/triangle.hh"
 #include "shapes/quad.hh"
+#include "shapes/mesh.hh"
+#include "shapes/sphereset.hh"
+#include "shapes/instance.hh"
 
 #include "utils/simply.hh"
 
@@ -20,7 +23,7 @@
 // The code below is so ass and messy bc i did it quickly
 // beware
 
-Scene CornellBox(size_t width, size_t height, const std::string &camera, int type) {
+Scene CornellBox(size_t width, size_t height, const std::string &camera, int type, const BVHConfig &bvhConfig = BVHConfig()) {
   Scene scene;
 
   Point O(0.0, 0.0, -3.5);
@@ -63,12 +66,9 @@ Scene CornellBox(size_t width, size_t height, const std::string &camera, int typ
     auto LBMaterial = std::make_shared<Slides::Material>(pink, black, black, black);
     auto RBMaterial = std::make_shared<Slides::Material>(light_blue, black, black, black);
 
-    scene.add(std::make_unique<GeometricPrimitive>(
-                std::make_shared<Sphere>(Point(-0.5, -0.7, 0.25), 0.3),
-                LBMaterial));
-    scene.add(std::make_unique<GeometricPrimitive>(
-                std::make_shared<Sphere>(Point(0.5, -0.7, -0.25), 0.3),
-                RBMaterial));
+    scene.add(std::make_unique<SphereSetPrimitive>(
+                std::vector<Sphere>{Sphere(Point(-0.5, -0.7, 0.25), 0.3), Sphere(Point(0.5, -0.7, -0.25), 0.3)},
+                std::vector<std::shared_ptr<IMaterial>>{LBMaterial, RBMaterial}));
   } else if (type == 1) {
     leftMaterial = redMaterial;
     rightMaterial = greenMaterial;
@@ -79,12 +79,9 @@ Scene CornellBox(size_t width, size_t height, const std::string &camera, int typ
     auto LBMaterial = std::make_shared<Slides::Material>(pink, black, black, black);
     auto RBMaterial = std::make_shared<Slides::Material>(light_blue, black, black, black);
 
-    scene.add(std::make_unique<GeometricPrimitive>(
-                std::make_shared<Sphere>(Point(-0.5, -0.7, 0.25), 0.3),
-                LBMaterial));
-    scene.add(std::make_unique<GeometricPrimitive>(
-                std::make_shared<Sphere>(Point(0.5, -0.7, -0.25), 0.3),
-                RBMaterial));
+    scene.add(std::make_unique<SphereSetPrimitive>(
+                std::vector<Sphere>{Sphere(Point(-0.5, -0.7, 0.25), 0.3), Sphere(Point(0.5, -0.7, -0.25), 0.3)},
+                std::vector<std::shared_ptr<IMaterial>>{LBMaterial, RBMaterial}));
   } else if (type == 2) {
     scene.add(PointLight(Point(0, 0.5, 0), Direction(0.1, 0.1, 0.1)));
     leftMaterial = redMaterial;
@@ -107,16 +104,9 @@ Scene CornellBox(size_t width, size_t height, const std::string &camera, int typ
     Float alpha = 0.45;
     auto teapotMaterial = std::make_shared<Slides::Material>(light_blue * alpha, black, Direction(1,1,1)-light_blue * alpha, black);
 
-    simply::PLYFile sus("assets/teapot.ply");
-    auto meshSus = std::make_shared<TriangleMesh>(
+    scene.add(TriangleMeshPrimitive::load("assets/teapot.ply",
       Mat4::rotate(M_PI / -2.0, 1, 0, 0) * Mat4::translation(0, 0, -0.9) * Mat4::scale(.2, .2, .2),
-      sus);
-
-    for (size_t i = 0; i < meshSus->nTriangles; i++)
-      scene.add(
-        std::make_unique<GeometricPrimitive>(
-          std::make_shared<Triangle>(meshSus, i),
-          teapotMaterial));
+      teapotMaterial, bvhConfig));
   } else if (type == 3 || type == 4) {
     bool pointLight = type == 3;
 
@@ -128,16 +118,9 @@ Scene CornellBox(size_t width, size_t height, const std::string &camera, int typ
 
     auto lucyMaterial = std::make_shared<Slides::Material>(Direction(0.9,0.9,0.9), black, black, black);
 
-    simply::PLYFile sus("assets/lucy.ply");
-    auto meshSus = std::make_shared<TriangleMesh>(
+    scene.add(TriangleMeshPrimitive::load("assets/lucy.ply",
       Mat4::translation(-0.5, -0.4, -0.25) * Mat4::scale(6, 6, 6),
-      sus);
-
-    for (size_t i = 0; i < meshSus->nTriangles; i++)
-      scene.add(
-        std::make_unique<GeometricPrimitive>(
-          std::make_shared<Triangle>(meshSus, i),
-          lucyMaterial));
+      lucyMaterial, bvhConfig));
 
     auto RBMaterial = std::make_shared<Slides::Material>(black, Direction(1,1,1), black, black);
     scene.add(std::make_unique<GeometricPrimitive>(
@@ -164,21 +147,13 @@ Scene CornellBox(size_t width, size_t height, const std::string &camera, int typ
     auto LBMaterial = std::make_shared<Slides::Material>(light_blue/1.5, Direction(1,1,1) - light_blue/1.5, black, black);
     auto RBMaterial = std::make_shared<Slides::Material>(black, Direction(1,1,1)*0.18, Direction(1,1,1)*0.82, black);
 
-    scene.add(std::make_unique<GeometricPrimitive>(
-                std::make_shared<Sphere>(Point(-0.5, -0.7, 0.25), 0.3),
-                LBMaterial));
-    scene.add(std::make_unique<GeometricPrimitive>(
-                std::make_shared<Sphere>(Point(0.5, -0.7, -0.25), 0.3),
-                RBMaterial));
+    scene.add(std::make_unique<SphereSetPrimitive>(
+                std::vector<Sphere>{Sphere(Point(-0.5, -0.7, 0.25), 0.3), Sphere(Point(0.5, -0.7, -0.25), 0.3)},
+                std::vector<std::shared_ptr<IMaterial>>{LBMaterial, RBMaterial}));
 
     if (!pointLight) {
       auto meshAreaL = Quad(Point(0, 0.99, 0), Direction(0.5, 0, 0), Direction(0, 0, 0.5), Direction(0, -1, 0));
-      scene.add(std::make_unique<GeometricPrimitive>(
-                  std::make_shared<Triangle>(meshAreaL, 0),
-                  whiteMaterialE));
-      scene.add(std::make_unique<GeometricPrimitive>(
-                  std::make_shared<Triangle>(meshAreaL, 1),
-                  whiteMaterialE));
+      scene.add(std::make_unique<TriangleMeshPrimitive>(meshAreaL, whiteMaterialE));
     }
   } else if (type == 7) {
     scene.add(PointLight(Point(0, 0.5, 0), Direction(0.5, 0.5, 0.5)));
@@ -204,18 +179,11 @@ Scene CornellBox(size_t width, size_t height, const std::string &camera, int typ
     auto bananaMaterial = std::make_shared<tex::Material>(bananaTex, blackTex, blackTex);
     auto harambeMaterial = std::make_shared<tex::Material>(harambeTex, blackTex, blackTex);
 
-    simply::PLYFile model("assets/banana.ply");
-    auto mesh= std::make_shared<TriangleMesh>(
+    scene.add(TriangleMeshPrimitive::load("assets/banana.ply",
       Mat4::rotate(M_PI, 1, 0, 0) *
       Mat4::translation(-0.4, 0.9, 0) *
       Mat4::scale(0.2, 0.2, 0.2),
-      model);
-
-    for (size_t i = 0; i < mesh->nTriangles; i++)
-      scene.add(
-        std::make_unique<GeometricPrimitive>(
-          std::make_shared<Triangle>(mesh, i),
-          bananaMaterial));
+      bananaMaterial, bvhConfig));
   
     const Float w = harambe.buffer.getWidth();
     const Float h = harambe.buffer.getHeight();
@@ -223,58 +191,28 @@ Scene CornellBox(size_t width, size_t height, const std::string &camera, int typ
     const Float alpha = 0.9;
 
     auto meshH = Quad(Point(0, 0, 0.99), Direction(-w/m, 0, 0)*alpha, Direction(0, -h/m, 0)*alpha, Direction(0, 0, -1));
-    scene.add(std::make_unique<GeometricPrimitive>(
-                std::make_shared<Triangle>(meshH, 0),
-                harambeMaterial));
-    scene.add(std::make_unique<GeometricPrimitive>(
-                std::make_shared<Triangle>(meshH, 1),
-                harambeMaterial));
+    scene.add(std::make_unique<TriangleMeshPrimitive>(meshH, harambeMaterial));
   }
 
   auto meshLeft = Quad(Point(-1, 0, 0), Direction(0, 1, 0), Direction(0, 0, 1), Direction(1, 0, 0));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshLeft, 0),
-              leftMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshLeft, 1),
-              leftMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshLeft, leftMaterial));
 
   auto meshRight = Quad(Point(1, 0, 0), Direction(0, 1, 0), Direction(0, 0, 1), (Direction(-1, 0, 0)));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshRight, 0),
-              rightMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshRight, 1),
-              rightMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshRight, rightMaterial));
 
   auto meshBack = Quad(Point(0, 0, 1), Direction(0, 1, 0), Direction(1, 0, 0), Direction(0, 0, -1));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBack, 0),
-              backMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBack, 1),
-              backMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshBack, backMaterial));
 
   auto meshTop = Quad(Point(0, 1, 0), Direction(1, 0, 0), Direction(0, 0, 1), Direction(0, -1, 0));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshTop, 0),
-              topMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshTop, 1),
-              topMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshTop, topMaterial));
 
   auto meshBot = Quad(Point(0, -1, 0), Direction(-1, 0, 0), Direction(0, 0, -1), Direction(0, 1, 0));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBot, 0),
-              botMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBot, 1),
-              botMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshBot, botMaterial));
   
   return scene;
 }
 
-Scene Cardioid(size_t width, size_t height, const std::string &camera) {
+Scene Cardioid(size_t width, size_t height, const std::string &camera, const BVHConfig &bvhConfig = BVHConfig()) {
   // const auto env = image::read("../envmap.ppm");
 
   Scene scene;
@@ -305,19 +243,12 @@ Scene Cardioid(size_t width, size_t height, const std::string &camera) {
 
   const auto floorMaterial = std::make_shared<tex::Material>(texWood, texNone, texNone);
 
-  simply::PLYFile mug("assets/mug.ply");
-  auto mesh = std::make_shared<TriangleMesh>(
+  scene.add(TriangleMeshPrimitive::load("assets/mug.ply",
     // Mat4::rotate(-0.4, 1, 0, 0) *
     // Mat4::translation(0, -0.6, 0) *
     Mat4::translation(0, -0.65, 0) *
     Mat4::scale(4, 4, 4),
-    mug);
-  
-  for (size_t i = 0; i < mesh->nTriangles; i++)
-    scene.add(
-      std::make_unique<GeometricPrimitive>(
-        std::make_shared<Triangle>(mesh, i),
-        mugMaterial));
+    mugMaterial, bvhConfig));
 
 
   // scene.add(PointLight(Point(0, 0.2, 0.6), Direction(0.2, 0.2, 0.2)));
@@ -326,26 +257,16 @@ Scene Cardioid(size_t width, size_t height, const std::string &camera) {
               emmisiveMaterial));
   
   auto meshBot = Quad(Point(0, -1, 0), Direction(-2, 0, 0), Direction(0, 0, -2), Direction(0, 1, 0));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBot, 0),
-              floorMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBot, 1),
-              floorMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshBot, floorMaterial));
 
   scene.add(PointLight(Point(0, 100, -100), Direction(30, 30, 30)));
   // auto meshTop = Quad(Point(0, 200, -300), Direction(-10, 0, 0), Direction(0, -10, 0), Direction(0, 1, 0));
-  // scene.add(std::make_unique<GeometricPrimitive>(
-  //             std::make_shared<Triangle>(meshTop, 0),
-  //             emmisiveMaterial));
-  // scene.add(std::make_unique<GeometricPrimitive>(
-  //             std::make_shared<Triangle>(meshTop, 1),
-  //             emmisiveMaterial));
+  // scene.add(std::make_unique<TriangleMeshPrimitive>(meshTop, emmisiveMaterial));
 
   return scene;
 }
 
-Scene Bunny(size_t width, size_t height, const std::string &camera) {
+Scene Bunny(size_t width, size_t height, const std::string &camera, const BVHConfig &bvhConfig = BVHConfig()) {
   Scene scene;
 
   bool pointLight = false;
@@ -382,63 +303,90 @@ Scene Bunny(size_t width, size_t height, const std::string &camera) {
 
   auto bunnyMaterial = std::make_shared<Slides::Material>(pink, white-pink *3/5, none, none);
 
-  simply::PLYFile bunny("assets/bunny.ply");
-  auto meshBunny = std::make_shared<TriangleMesh>(
+  scene.add(TriangleMeshPrimitive::load("assets/bunny.ply",
     Mat4::translation(0, -0.6230, 0) * Mat4::scale(6, 6, 6),
-    bunny);
-  
-  for (size_t i = 0; i < meshBunny->nTriangles; i++)
-    scene.add(
-      std::make_unique<GeometricPrimitive>(
-        std::make_shared<Triangle>(meshBunny, i),
-        bunnyMaterial));
+    bunnyMaterial, bvhConfig));
 
   auto meshLeft = Quad(Point(-1, -0.7, 0), Direction(0, 1, 0), Direction(0, 0, 1), Direction(1, 0, 0));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshLeft, 0),
-              greenMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshLeft, 1),
-              greenMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshLeft, greenMaterial));
 
   auto meshRight = Quad(Point(1, -0.7, 0), Direction(0, 1, 0), Direction(0, 0, 1), (Direction(-1, 0, 0)));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshRight, 0),
-              redMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshRight, 1),
-              redMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshRight, redMaterial));
 
   auto meshBack = Quad(Point(0, 0, 1), Direction(0, 10, 0), Direction(10, 0, 0), Direction(0, 0, -1));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBack, 0),
-              whiteMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBack, 1),
-              whiteMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshBack, whiteMaterial));
 
   auto meshBot = Quad(Point(0, -1, 0), Direction(-1, 0, 0), Direction(0, 0, -1), Direction(0, 1, 0));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBot, 0),
-              whiteMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBot, 1),
-              whiteMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshBot, whiteMaterial));
 
   if (areaLight) {
     auto meshTop = Quad(Point(0, 0.4, 0), Direction(100, 0, 0), Direction(0, 0, 1), Direction(0, -1, 0));
-    scene.add(std::make_unique<GeometricPrimitive>(
-                std::make_shared<Triangle>(meshTop, 0),
-                emmMaterial));
-    scene.add(std::make_unique<GeometricPrimitive>(
-                std::make_shared<Triangle>(meshTop, 1),
-                emmMaterial));
+    scene.add(std::make_unique<TriangleMeshPrimitive>(meshTop, emmMaterial));
   }
   
   return scene;
 }
 
-Scene CornellBoxR(size_t width, size_t height, const std::string &camera) {
+// Same room as Bunny with a grid of instances of a single bunny mesh
+Scene Bunnies(size_t width, size_t height, const std::string &camera, const BVHConfig &bvhConfig = BVHConfig()) {
+  Scene scene;
+
+  Point O(0, 0, -3.5);
+  Point lookAt(0, -0.5, 0);
+  std::shared_ptr<Camera> cam;
+  if (camera == "pinhole")
+    cam = std::make_shared<PinholeCamera>(width, height, O, lookAt, 4.1);
+  else if (camera == "orthographic")
+    cam = std::make_shared<OrthographicCamera>(width, height, O, lookAt, 1);
+  else
+    throw std::runtime_error("Invalid camera (this should not happen)");
+
+  scene.set(cam);
+
+  const auto none = Direction(0, 0, 0);
+  const auto white = Direction(.9, .9, .9);
+  const auto red   = Direction(.9, .2, .2);
+  const auto green = Direction(.2, .9, .2);
+  const auto pink = Direction(0.8941, 0.66667, 0.9);
+
+  auto whiteMaterial = std::make_shared<Slides::Material>(white, none, none, none);
+  auto redMaterial = std::make_shared<Slides::Material>(red, none, none, none);
+  auto greenMaterial = std::make_shared<Slides::Material>(green, none, none, none);
+  auto emmMaterial = std::make_shared<Slides::Material>(white, none, none, white);
+  auto bunnyMaterial = std::make_shared<Slides::Material>(pink, white-pink *3/5, none, none);
+
+  // A single BLAS in object space, the instances only add a transform each
+  std::shared_ptr<TriangleMeshPrimitive> blasBunny =
+    TriangleMeshPrimitive::load("assets/bunny.ply", Mat4::identity(), bunnyMaterial, bvhConfig);
+
+  const Float s = 2.5;
+  const Float floor = -1 + 0.0619 * s; // Lowest vertex of the bunny on the floor
+  for (int i = 0; i < 3; i++)
+    for (int j = 0; j < 3; j++)
+      scene.add(std::make_unique<Instance>(blasBunny,
+                  Mat4::translation(0.55 * (i - 1), floor, 0.6 * j - 0.5) *
+                  Mat4::rotate(M_PI / 4 * (3 * i + j), 0, 1, 0) *
+                  Mat4::scale(s, s, s)));
+
+  auto meshLeft = Quad(Point(-1, -0.7, 0), Direction(0, 1, 0), Direction(0, 0, 1), Direction(1, 0, 0));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshLeft, greenMaterial));
+
+  auto meshRight = Quad(Point(1, -0.7, 0), Direction(0, 1, 0), Direction(0, 0, 1), (Direction(-1, 0, 0)));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshRight, redMaterial));
+
+  auto meshBack = Quad(Point(0, 0, 1), Direction(0, 10, 0), Direction(10, 0, 0), Direction(0, 0, -1));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshBack, whiteMaterial));
+
+  auto meshBot = Quad(Point(0, -1, 0), Direction(-1, 0, 0), Direction(0, 0, -1), Direction(0, 1, 0));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshBot, whiteMaterial));
+
+  auto meshTop = Quad(Point(0, 0.4, 0), Direction(100, 0, 0), Direction(0, 0, 1), Direction(0, -1, 0));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshTop, emmMaterial));
+
+  return scene;
+}
+
+Scene CornellBoxR(size_t width, size_t height, const std::string &camera, const BVHConfig &/*bvhConfig*/ = BVHConfig()) {
   Scene scene;
 
   Point O(-3.5, 0.0, 0);
@@ -486,74 +434,35 @@ Scene CornellBoxR(size_t width, size_t height, const std::string &camera) {
   const auto hardMaterial = std::make_shared<tex::Material>(texHard, texNone, texNone);
   const auto uvMaterial = std::make_shared<tex::Material>(texUV, texNone, texNone);
 
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Sphere>(Point(-0.25, -0.7, -0.5), 0.3),
-              RBMaterial));
-  
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Sphere>(Point(0.25, -0.7, 0.5), 0.3),
-              LBMaterial));
+  scene.add(std::make_unique<SphereSetPrimitive>(
+              std::vector<Sphere>{Sphere(Point(-0.25, -0.7, -0.5), 0.3), Sphere(Point(0.25, -0.7, 0.5), 0.3)},
+              std::vector<std::shared_ptr<IMaterial>>{RBMaterial, LBMaterial}));
 
   auto meshImage1 = Quad(Point(0.999, 0.4, 0.4), Direction(0, 0.4, 0), Direction(0, 0, 0.4), (Direction(-1, 0, 0)));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshImage1, 0),
-              hardMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshImage1, 1),
-              hardMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshImage1, hardMaterial));
 
   auto meshImage2 = Quad(Point(0.5, 0.5, -0.999), Direction(0, 0.5, 0), Direction(0.5, 0, 0), Direction(0, 0, -1));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshImage2, 0),
-              uvMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshImage2, 1),
-              uvMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshImage2, uvMaterial));
 
   auto meshLeft = Quad(Point(0, 0, 1), Direction(0, 1, 0), Direction(1, 0, 0), Direction(0, 0, 1));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshLeft, 0),
-              leftMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshLeft, 1),
-              leftMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshLeft, leftMaterial));
 
   auto meshRight = Quad(Point(0, 0, -1), Direction(0, 1, 0), Direction(1, 0, 0), Direction(0, 0, -1));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshRight, 0),
-              rightMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshRight, 1),
-              rightMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshRight, rightMaterial));
 
   auto meshBack = Quad(Point(1, 0, 0), Direction(0, 1, 0), Direction(0, 0, 1), (Direction(-1, 0, 0)));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBack, 0),
-              backMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBack, 1),
-              backMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshBack, backMaterial));
 
   auto meshTop = Quad(Point(0, 1, 0), Direction(1, 0, 0), Direction(0, 0, 1), Direction(0, -1, 0));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshTop, 0),
-              topMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshTop, 1),
-              topMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshTop, topMaterial));
 
   auto meshBot = Quad(Point(0, -1, 0), Direction(-1, 0, 0), Direction(0, 0, -1), Direction(0, 1, 0));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBot, 0),
-              botMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshBot, 1),
-              botMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshBot, botMaterial));
   
   return scene;
 }
 
-Scene LTO(size_t width, size_t height, const std::string &camera) {
+Scene LTO(size_t width, size_t height, const std::string &camera, const BVHConfig &bvhConfig = BVHConfig()) {
   Scene scene;
 
   // Camera
@@ -594,37 +503,20 @@ Scene LTO(size_t width, size_t height, const std::string &camera) {
   const auto ballMaterial = std::make_shared<tex::Material>(grayCte, texNoise1, texNone);
 
   auto meshEmitter = Quad(Point(0, 3.2, 0), Direction(-1, 0, 0), Direction(0, 0, -1), Direction(0, 1, 0));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshEmitter, 0),
-              emitter));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshEmitter, 1),
-              emitter));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshEmitter, emitter));
 
   auto meshFloor = Quad(Point(0, 0, 0), Direction(-1.5, 0, 0), Direction(0, 0, -1.5), Direction(0, 1, 0));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshFloor, 0),
-              woodMaterial));
-  scene.add(std::make_unique<GeometricPrimitive>(
-              std::make_shared<Triangle>(meshFloor, 1),
-              woodMaterial));
+  scene.add(std::make_unique<TriangleMeshPrimitive>(meshFloor, woodMaterial));
 
   scene.add(std::make_unique<GeometricPrimitive>(
             std::make_shared<Sphere>(Point(0, 0.3, 0.0), 0.19),
             ballMaterial));
   
 
-  simply::PLYFile LTO("assets/orb.ply");
-  auto meshLTO = std::make_shared<TriangleMesh>(
+  scene.add(TriangleMeshPrimitive::load("assets/orb.ply",
     Mat4::rotate(M_PI/2.0, 0, 1, 0) *
     Mat4::scale(2, 2, 2),
-    LTO);
-  
-  for (size_t i = 0; i < meshLTO->nTriangles; i++)
-    scene.add(
-      std::make_unique<GeometricPrimitive>(
-        std::make_shared<Triangle>(meshLTO, i),
-        LTOMaterial));
+    LTOMaterial, bvhConfig));
 
   return scene;
 }
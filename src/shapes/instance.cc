@@ -0,0 +1,64 @@
+#include "instance.hh"
+
+Instance::Instance(const std::shared_ptr<const Primitive> &object_, const Mat4 &objectToWorld_)
+  : object{object_} { setTransform(objectToWorld_); }
+
+void Instance::setTransform(const Mat4 &objectToWorld_) {
+  objectToWorld = objectToWorld_;
+  worldToObject = objectToWorld.invert();
+  normalToWorld = worldToObject.transpose();
+
+  const Bounds b = object->bounds();
+  worldBounds = Bounds();
+  for (int i = 0; i < 8; i++) {
+    const Point corner(b[i & 1].x, b[(i >> 1) & 1].y, b[(i >> 2) & 1].z);
+    worldBounds = worldBounds.Union(objectToWorld * corner);
+  }
+}
+
+Bounds Instance::bounds() const { return worldBounds; }
+
+Ray Instance::toObject(const Ray &ray, Float &scale) const {
+  const Direction d = worldToObject * ray.d;
+  scale = d.norm();
+  return Ray(worldToObject * ray.o, d, ray.tMin * scale, ray.tMax * scale);
+}
+
+bool Instance::intersect(const Ray &ray, HitRecord &hit) const {
+  Float scale;
+  const Ray r = toObject(ray, scale);
+
+  HitRecord objectHit;
+  if (!object->intersect(r, objectHit)) return false;
+
+  hit = objectHit;
+  hit.t = objectHit.t / scale;
+  hit.object = objectHit.primitive;
+  hit.primitive = this;
+  ray.tMax = hit.t;
+  return true;
+}
+
+bool Instance::intersectP(const Ray &ray) const {
+  Float scale;
+  return object->intersectP(toObject(ray, scale));
+}
+
+void Instance::interaction(const Ray &ray, const HitRecord &hit,
+                           SurfaceInteraction &interact) const {
+  Float scale;
+  const Ray r = toObject(ray, scale);
+
+  HitRecord objectHit = hit;
+  objectHit.t = hit.t * scale;
+  objectHit.primitive = hit.object;
+  objectHit.object = nullptr;
+  objectHit.primitive->interaction(r, objectHit, interact);
+
+  // Back to world space, the normal with the inverse transpose
+  interact.p = ray(hit.t);
+  interact.t = hit.t;
+  interact.n = (normalToWorld * interact.n).normalize();
+  interact.wo = -ray.d;
+  interact.entering = interact.n.dot(ray.d) < 0;
+}
@@ -0,0 +1,33 @@
+#ifndef INSTANCE_H_
+#define INSTANCE_H_
+
+#include "ver.hh"
+#include "shapes/primitive.hh"
+
+// Places a shared bottom-level structure (usually a TriangleMeshPrimitive,
+// which has its own BVH) in the world. Rays are moved into object space
+// instead of baking the transform into the geometry, so many instances cost
+// the memory of one mesh and moving them only needs a new top-level BVH.
+class Instance : public Primitive {
+  public:
+    Instance(const std::shared_ptr<const Primitive> &object_, const Mat4 &objectToWorld_);
+
+    void setTransform(const Mat4 &objectToWorld_);
+    const Mat4 &transform() const { return objectToWorld; }
+
+    Bounds bounds() const override;
+    bool intersect(const Ray &ray, HitRecord &hit) const override;
+    bool intersectP(const Ray &ray) const override;
+    void interaction(const Ray &ray, const HitRecord &hit,
+                     SurfaceInteraction &interact) const override;
+
+  private:
+    // Object space ray, scale converts world distances to object ones
+    Ray toObject(const Ray &ray, Float &scale) const;
+
+    std::shared_ptr<const Primitive> object;
+    Mat4 objectToWorld, worldToObject, normalToWorld;
+    Bounds worldBounds;
+};
+
+#endif // INSTANCE_H_
@@ -0,0 +1,450 @@
+#include "mesh.hh"
+#include "materials/material.hh"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <type_traits>
+
+namespace {
+  // Cache files start with this header, every section is addressed by its
+  // offset from the start of the file so the file can be mapped anywhere
+  struct CacheHeader {
+    char magic[8];
+    uint64_t key;
+    uint64_t nTriangles, nVertices, nNodes, nPacks;
+    uint64_t width; // Of the BVH nodes: 2 (LinearBVHNode), 4 or 8 (WideBVHNode)
+    uint64_t nNormals, nTangents, nUVs; // Either 0 or nVertices
+    uint64_t indices, p, n, s, uv, nodes, packs; // Section offsets
+  };
+
+  const char cacheMagic[8] = {'V', 'E', 'R', 'B', 'V', 'H', '0', '2'};
+  const size_t cacheAlignment = 64;
+
+  static_assert(std::is_trivially_copyable<Point>::value && std::is_trivially_copyable<Direction>::value &&
+                std::is_trivially_copyable<Vec2>::value && std::is_trivially_copyable<LinearBVHNode>::value &&
+                std::is_trivially_copyable<TrianglePack>::value && std::is_trivially_copyable<WideBVHNode<4>>::value &&
+                std::is_trivially_copyable<WideBVHNode<8>>::value, "Cached data must be trivially copyable");
+  static_assert(sizeof(Mat4) == 16 * sizeof(Float), "The transform is hashed as raw bytes");
+
+  size_t align(size_t offset) { return (offset + cacheAlignment - 1) / cacheAlignment * cacheAlignment; }
+
+  size_t nodeSize(uint64_t width) {
+    return (width == 4) ? sizeof(WideBVHNode<4>) : (width == 8) ? sizeof(WideBVHNode<8>) : sizeof(LinearBVHNode);
+  }
+
+  // Leaves are tested a pack at a time, so the SAH counts packs, not triangles
+  BVHConfig packedConfig(const BVHConfig &config) {
+    BVHConfig packed = config;
+    packed.leafPackWidth = packWidth;
+    return packed;
+  }
+
+  // Hash of everything the cached data depends on: the asset, the transform,
+  // the build settings and the layout of the stored types. The asset is
+  // identified by its path, size and modification time, so that a cache hit
+  // never reads the PLY at all.
+  uint64_t cacheKey(const std::string &filename, const Mat4 &transform, const BVHConfig &config) {
+    const std::string path = std::filesystem::absolute(filename).string();
+    const uint64_t asset[] = {
+      static_cast<uint64_t>(std::filesystem::file_size(filename)),
+      static_cast<uint64_t>(std::filesystem::last_write_time(filename).time_since_epoch().count())
+    };
+    uint64_t key = hash(path.data(), path.size());
+    key = hash(asset, sizeof(asset), key);
+    key = hash(&transform, sizeof(Mat4), key);
+
+    const uint64_t settings[] = {
+      static_cast<uint64_t>(config.splitMethod), config.maxPrimsInNode, config.nBuckets, config.width,
+      sizeof(Float), sizeof(size_t), sizeof(LinearBVHNode), sizeof(WideBVHNode<4>), sizeof(WideBVHNode<8>),
+      sizeof(TrianglePack), packWidth
+    };
+    key = hash(settings, sizeof(settings), key);
+    key = hash(&config.traversalCost, sizeof(Float), key);
+    key = hash(&config.intersectionCost, sizeof(Float), key);
+    key = hash(&config.spatialSplitBudget, sizeof(Float), key);
+    key = hash(&config.spatialSplitAlpha, sizeof(Float), key);
+    return key;
+  }
+
+  // Whether a leaf of nPrims triangles starting at pack offset lies within the packs
+  bool leafFits(uint64_t offset, uint64_t nPrims, size_t nPacks) {
+    return offset <= nPacks && (nPrims + packWidth - 1) / packWidth <= nPacks - offset;
+  }
+
+  // Checks node i of a mapped tree, adding its interior children to
+  // children. Children must come after their parents.
+  bool checkNode(const LinearBVHNode *nodes, size_t i, size_t nNodes, size_t nPacks, std::vector<size_t> &children) {
+    const LinearBVHNode &node = nodes[i];
+    if (node.nPrims > 0) return leafFits(node.offset, node.nPrims, nPacks);
+    if (node.offset <= i + 1 || node.offset >= nNodes) return false;
+    children.push_back(i + 1);
+    children.push_back(node.offset);
+    return true;
+  }
+
+  template <int N>
+  bool checkNode(const WideBVHNode<N> *nodes, size_t i, size_t nNodes, size_t nPacks, std::vector<size_t> &children) {
+    const WideBVHNode<N> &node = nodes[i];
+    if (node.nChildren < 1 || node.nChildren > N) return false;
+    for (int c = 0; c < node.nChildren; c++) {
+      if (node.nPrims[c] > 0) {
+        if (!leafFits(node.offset[c], node.nPrims[c], nPacks)) return false;
+      } else {
+        if (node.offset[c] <= i || node.offset[c] >= nNodes) return false;
+        children.push_back(node.offset[c]);
+      }
+    }
+    return true;
+  }
+
+  // Whether a mapped tree can be traversed safely: every node is reached
+  // exactly once from the root, within the depth the traversal stacks hold,
+  // and every leaf only covers existing packs
+  template <typename Node>
+  bool validTree(const Node *nodes, size_t nNodes, size_t nPacks) {
+    constexpr size_t maxDepth = 64;
+    if (nNodes == 0) return nPacks == 0;
+
+    std::vector<bool> reached(nNodes, false);
+    std::vector<std::pair<size_t, size_t>> toVisit = {{0, 0}}; // Node and depth
+    std::vector<size_t> children;
+    size_t nReached = 0;
+    while (!toVisit.empty()) {
+      const auto [i, depth] = toVisit.back();
+      toVisit.pop_back();
+      if (reached[i] || depth >= maxDepth) return false;
+      reached[i] = true;
+      nReached++;
+
+      children.clear();
+      if (!checkNode(nodes, i, nNodes, nPacks, children)) return false;
+      for (size_t child : children) toVisit.push_back({child, depth + 1});
+    }
+    return nReached == nNodes;
+  }
+
+  // Copies a section of a mapped cache file into a vector
+  template <typename T>
+  std::vector<T> section(const MappedFile &file, uint64_t offset, uint64_t count) {
+    std::vector<T> v(count);
+    if (count > 0) std::memcpy(v.data(), file.data() + offset, count * sizeof(T));
+    return v;
+  }
+}
+
+TriangleMeshPrimitive::TriangleMeshPrimitive(const std::shared_ptr<TriangleMesh> &mesh_,
+                                             const std::shared_ptr<IMaterial> &material_,
+                                             const BVHConfig &config)
+  : mesh{mesh_}, material{material_}, ownedNodes{}, ownedNodes4{}, ownedNodes8{}, ownedPacks{}, cache{},
+    nodes{nullptr}, nodes4{nullptr}, nodes8{nullptr}, nNodes{0}, packs{nullptr}, nPacks{0} {
+  const size_t nTriangles = mesh->nTriangles;
+  if (nTriangles == 0) return;
+
+  std::vector<BVHPrimitiveInfo> triangleInfo(nTriangles);
+  #pragma omp parallel for
+  for (size_t i = 0; i < nTriangles; i++) {
+    const size_t *v = &mesh->indices[3 * i];
+    triangleInfo[i] = BVHPrimitiveInfo(i, Bounds(mesh->p[v[0]]).Union(mesh->p[v[1]]).Union(mesh->p[v[2]]));
+  }
+
+  ownedNodes = (config.splitMethod == SplitMethod::SBVH)
+             ? buildSBVH(triangleInfo, packedConfig(config), mesh->indices, mesh->p)
+             : buildBVH(triangleInfo, packedConfig(config));
+
+  ownedPacks = packLeaves(ownedNodes, triangleInfo, TrianglePack{}, [&](TrianglePack &pack, int lane, size_t triangle) {
+    const size_t *v = &mesh->indices[3 * triangle];
+    const Point &p0 = mesh->p[v[0]];
+    const Direction e1 = mesh->p[v[1]] - p0;
+    const Direction e2 = mesh->p[v[2]] - p0;
+    for (int a = 0; a < 3; a++) {
+      pack.p0[a][lane] = static_cast<float>(p0[a]);
+      pack.e1[a][lane] = static_cast<float>(e1[a]);
+      pack.e2[a][lane] = static_cast<float>(e2[a]);
+    }
+    pack.id[lane] = triangle;
+  });
+
+  // Leaves point to packs by now, collapsing keeps their ranges
+  if (config.width == 4) {
+    ownedNodes4 = collapseBVH<4>(ownedNodes);
+    ownedNodes.clear();
+    nodes4 = ownedNodes4.data();
+    nNodes = ownedNodes4.size();
+  } else if (config.width == 8) {
+    ownedNodes8 = collapseBVH<8>(ownedNodes);
+    ownedNodes.clear();
+    nodes8 = ownedNodes8.data();
+    nNodes = ownedNodes8.size();
+  } else {
+    nodes = ownedNodes.data();
+    nNodes = ownedNodes.size();
+  }
+  packs = ownedPacks.data();
+  nPacks = ownedPacks.size();
+}
+
+TriangleMeshPrimitive::TriangleMeshPrimitive(const std::shared_ptr<TriangleMesh> &mesh_,
+                                             const std::shared_ptr<IMaterial> &material_,
+                                             std::unique_ptr<MappedFile> &&file)
+  : mesh{mesh_}, material{material_}, ownedNodes{}, ownedNodes4{}, ownedNodes8{}, ownedPacks{}, cache{std::move(file)},
+    nodes{nullptr}, nodes4{nullptr}, nodes8{nullptr}, nNodes{0}, packs{nullptr}, nPacks{0} {}
+
+std::unique_ptr<TriangleMeshPrimitive> TriangleMeshPrimitive::load(const std::string &filename, const Mat4 &transform,
+                                                                   const std::shared_ptr<IMaterial> &material_,
+                                                                   const BVHConfig &config) {
+  if (config.cacheDir.empty()) {
+    simply::PLYFile ply(filename);
+    return std::make_unique<TriangleMeshPrimitive>(std::make_shared<TriangleMesh>(transform, ply), material_, config);
+  }
+
+  const uint64_t key = cacheKey(filename, transform, config);
+  std::stringstream name;
+  name << std::hex << std::setw(16) << std::setfill('0') << key << ".bvh";
+  const std::string cacheFile = (std::filesystem::path(config.cacheDir) / name.str()).string();
+
+  if (std::filesystem::exists(cacheFile)) {
+    DEBUG_CODE({
+      std::cout << "[BVH CACHE READ " << cacheFile << "]" << std::endl;
+    });
+    if (auto prim = fromCache(std::make_unique<MappedFile>(cacheFile), key, material_))
+      return prim;
+  }
+
+  simply::PLYFile ply(filename);
+  auto prim = std::make_unique<TriangleMeshPrimitive>(std::make_shared<TriangleMesh>(transform, ply), material_, config);
+  prim->save(cacheFile, key);
+  return prim;
+}
+
+std::unique_ptr<TriangleMeshPrimitive> TriangleMeshPrimitive::fromCache(std::unique_ptr<MappedFile> &&file, uint64_t key,
+                                                                        const std::shared_ptr<IMaterial> &material_) {
+  if (file->size() < sizeof(CacheHeader)) return nullptr;
+  CacheHeader header;
+  std::memcpy(&header, file->data(), sizeof(CacheHeader));
+  if (std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.key != key ||
+      (header.width != 2 && header.width != 4 && header.width != 8))
+    return nullptr;
+
+  auto fits = [&](uint64_t offset, uint64_t count, size_t size) {
+    return offset % cacheAlignment == 0 && offset <= file->size() && count <= (file->size() - offset) / size;
+  };
+  if (!fits(header.indices, 3 * header.nTriangles, sizeof(size_t)) ||
+      !fits(header.p, header.nVertices, sizeof(Point)) ||
+      !fits(header.n, header.nNormals, sizeof(Direction)) ||
+      !fits(header.s, header.nTangents, sizeof(Direction)) ||
+      !fits(header.uv, header.nUVs, sizeof(Vec2)) ||
+      !fits(header.nodes, header.nNodes, nodeSize(header.width)) ||
+      !fits(header.packs, header.nPacks, sizeof(TrianglePack)))
+    return nullptr;
+
+  if ((header.nNormals != 0 && header.nNormals != header.nVertices) ||
+      (header.nTangents != 0 && header.nTangents != header.nVertices) ||
+      (header.nUVs != 0 && header.nUVs != header.nVertices))
+    return nullptr;
+
+  // A damaged file may still have consistent extents, so the contents the
+  // traversal and shading index with are checked too before trusting them
+  const char *data = file->data();
+  const auto *packs_ = reinterpret_cast<const TrianglePack *>(data + header.packs);
+  bool valid = (header.width == 4) ? validTree(reinterpret_cast<const WideBVHNode<4> *>(data + header.nodes), header.nNodes, header.nPacks)
+             : (header.width == 8) ? validTree(reinterpret_cast<const WideBVHNode<8> *>(data + header.nodes), header.nNodes, header.nPacks)
+             : validTree(reinterpret_cast<const LinearBVHNode *>(data + header.nodes), header.nNodes, header.nPacks);
+  #pragma omp parallel for reduction(&&:valid)
+  for (size_t k = 0; k < header.nPacks; k++)
+    for (int lane = 0; lane < packWidth; lane++)
+      valid = valid && packs_[k].id[lane] < header.nTriangles;
+  auto indices_ = section<size_t>(*file, header.indices, 3 * header.nTriangles);
+  #pragma omp parallel for reduction(&&:valid)
+  for (size_t k = 0; k < indices_.size(); k++)
+    valid = valid && indices_[k] < header.nVertices;
+  if (!valid) return nullptr;
+
+  // The mesh is only read for shading, copying it is cheap next to parsing
+  // the PLY. The nodes and packs are traversed straight from the mapping.
+  auto mesh_ = std::make_shared<TriangleMesh>(std::move(indices_),
+                                              section<Point>(*file, header.p, header.nVertices),
+                                              section<Direction>(*file, header.n, header.nNormals),
+                                              section<Direction>(*file, header.s, header.nTangents),
+                                              section<Vec2>(*file, header.uv, header.nUVs));
+
+  std::unique_ptr<TriangleMeshPrimitive> prim(new TriangleMeshPrimitive(mesh_, material_, std::move(file)));
+  if (header.width == 4)
+    prim->nodes4 = reinterpret_cast<const WideBVHNode<4> *>(data + header.nodes);
+  else if (header.width == 8)
+    prim->nodes8 = reinterpret_cast<const WideBVHNode<8> *>(data + header.nodes);
+  else
+    prim->nodes = reinterpret_cast<const LinearBVHNode *>(data + header.nodes);
+  prim->nNodes = header.nNodes;
+  prim->packs = packs_;
+  prim->nPacks = header.nPacks;
+  return prim;
+}
+
+void TriangleMeshPrimitive::save(const std::string &filename, uint64_t key) const {
+  CacheHeader header{};
+  std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+  header.key = key;
+  header.nTriangles = mesh->nTriangles;
+  header.nVertices = mesh->p.size();
+  header.nNormals = mesh->n.size();
+  header.nTangents = mesh->s.size();
+  header.nUVs = mesh->uv.size();
+  header.nNodes = nNodes;
+  header.nPacks = nPacks;
+  header.width = nodes4 ? 4 : nodes8 ? 8 : 2;
+
+  header.indices = align(sizeof(CacheHeader));
+  header.p = align(header.indices + mesh->indices.size() * sizeof(size_t));
+  header.n = align(header.p + header.nVertices * sizeof(Point));
+  header.s = align(header.n + header.nNormals * sizeof(Direction));
+  header.uv = align(header.s + header.nTangents * sizeof(Direction));
+  header.nodes = align(header.uv + header.nUVs * sizeof(Vec2));
+  header.packs = align(header.nodes + header.nNodes * nodeSize(header.width));
+
+  // Written next to the final name and renamed, so that a reader never maps
+  // a half written file
+  const std::string tmp = filename + ".tmp";
+  {
+    std::error_code error;
+    std::filesystem::create_directories(std::filesystem::path(filename).parent_path(), error);
+    std::ofstream file(tmp, std::ofstream::binary | std::ofstream::trunc);
+    auto put = [&](uint64_t offset, const void *data, size_t size) {
+      static const char zeros[cacheAlignment] = {};
+      file.write(zeros, offset - file.tellp());
+      file.write(static_cast<const char *>(data), size);
+    };
+    put(0, &header, sizeof(CacheHeader));
+    put(header.indices, mesh->indices.data(), mesh->indices.size() * sizeof(size_t));
+    put(header.p, mesh->p.data(), header.nVertices * sizeof(Point));
+    put(header.n, mesh->n.data(), header.nNormals * sizeof(Direction));
+    put(header.s, mesh->s.data(), header.nTangents * sizeof(Direction));
+    put(header.uv, mesh->uv.data(), header.nUVs * sizeof(Vec2));
+    withNodes([&](const auto *tree, size_t) { put(header.nodes, tree, header.nNodes * nodeSize(header.width)); });
+    put(header.packs, packs, header.nPacks * sizeof(TrianglePack));
+
+    if (!file) {
+      std::cerr << "Could not write BVH cache: " << filename << std::endl;
+      return;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tmp, filename, error);
+  if (error)
+    std::cerr << "Could not write BVH cache: " << filename << std::endl;
+}
+
+BVHStats TriangleMeshPrimitive::stats(const BVHConfig &config) const {
+  BVHStats stats = withNodes([&](const auto *tree, size_t n) { return bvhStats(tree, n, packedConfig(config)); });
+  stats.memory += nPacks * sizeof(TrianglePack);
+  return stats;
+}
+
+Bounds TriangleMeshPrimitive::bounds() const {
+  if (nNodes == 0) return Bounds();
+  if (nodes4) return childBounds(nodes4[0]);
+  if (nodes8) return childBounds(nodes8[0]);
+  return nodes[0].bounds;
+}
+
+bool TriangleMeshPrimitive::intersect(const Ray &ray, HitRecord &hit) const {
+  const PackRay r(ray);
+
+  auto intersectLeaf = [&](uint offset, uint nPrims) {
+    bool leafHit = false;
+    for (uint k = offset; k < offset + (nPrims + packWidth - 1) / packWidth; k++) {
+      float t[packWidth], u[packWidth], v[packWidth];
+      const int mask = intersectPack(packs[k], r, ray.tMin, ray.tMax, t, u, v);
+      if (!mask) continue;
+
+      for (int i = 0; i < packWidth; i++) {
+        if (!(mask & (1 << i)) || t[i] >= ray.tMax) continue;
+        ray.tMax = t[i];
+        hit.t = t[i];
+        hit.b1 = u[i];
+        hit.b2 = v[i];
+        hit.primitive = this;
+        hit.primID = packs[k].id[i];
+        leafHit = true;
+      }
+    }
+    return leafHit;
+  };
+  return withNodes([&](const auto *tree, size_t n) { return traverseBVH<false>(tree, n, ray, intersectLeaf); });
+}
+
+void TriangleMeshPrimitive::intersectPacket(RayPacket &packet, uint32_t lanes, HitRecord hits[]) const {
+  PackRay r[packetSize];
+  for (int i = 0; i < packetSize; i++)
+    if (lanes & (1u << i)) r[i] = PackRay(packet.rays[i]);
+
+  auto intersectLeaf = [&](uint offset, uint nPrims, uint32_t active) {
+    for (uint k = offset; k < offset + (nPrims + packWidth - 1) / packWidth; k++) {
+      for (int lane = 0; lane < packetSize; lane++) {
+        if (!(active & (1u << lane))) continue;
+        const Ray &ray = packet.rays[lane];
+
+        float t[packWidth], u[packWidth], v[packWidth];
+        const int mask = intersectPack(packs[k], r[lane], ray.tMin, ray.tMax, t, u, v);
+        if (!mask) continue;
+
+        for (int i = 0; i < packWidth; i++) {
+          if (!(mask & (1 << i)) || t[i] >= ray.tMax) continue;
+          ray.tMax = t[i];
+          hits[lane].t = t[i];
+          hits[lane].b1 = u[i];
+          hits[lane].b2 = v[i];
+          hits[lane].primitive = this;
+          hits[lane].primID = packs[k].id[i];
+        }
+        packet.shrink(lane);
+      }
+    }
+  };
+  withNodes([&](const auto *tree, size_t n) { traverseBVHPacket(tree, n, packet, lanes, intersectLeaf); });
+}
+
+uint32_t TriangleMeshPrimitive::intersectPPacket(const RayPacket &packet, uint32_t lanes) const {
+  PackRay r[packetSize];
+  for (int i = 0; i < packetSize; i++)
+    if (lanes & (1u << i)) r[i] = PackRay(packet.rays[i]);
+
+  auto intersectLeaf = [&](uint offset, uint nPrims, uint32_t active) {
+    uint32_t blocked = 0;
+    for (uint k = offset; k < offset + (nPrims + packWidth - 1) / packWidth; k++) {
+      for (int lane = 0; lane < packetSize; lane++) {
+        if (!(active & (1u << lane)) || (blocked & (1u << lane))) continue;
+        const Ray &ray = packet.rays[lane];
+
+        float t[packWidth], u[packWidth], v[packWidth];
+        if (intersectPack(packs[k], r[lane], ray.tMin, ray.tMax, t, u, v))
+          blocked |= 1u << lane;
+      }
+    }
+    return blocked;
+  };
+  return withNodes([&](const auto *tree, size_t n) { return traverseBVHPacketP(tree, n, packet, lanes, intersectLeaf); });
+}
+
+bool TriangleMeshPrimitive::intersectP(const Ray &ray) const {
+  const PackRay r(ray);
+
+  auto intersectLeaf = [&](uint offset, uint nPrims) {
+    for (uint k = offset; k < offset + (nPrims + packWidth - 1) / packWidth; k++) {
+      float t[packWidth], u[packWidth], v[packWidth];
+      if (intersectPack(packs[k], r, ray.tMin, ray.tMax, t, u, v))
+        return true;
+    }
+    return false;
+  };
+  return withNodes([&](const auto *tree, size_t n) { return traverseBVH<true>(tree, n, ray, intersectLeaf); });
+}
+
+void TriangleMeshPrimitive::interaction(const Ray &ray, const HitRecord &hit,
+                                        SurfaceInteraction &interact) const {
+  const size_t *v = &mesh->indices[3 * hit.primID];
+  mesh->interaction(v[0], v[1], v[2], ray, hit, interact);
+  interact.material = material.get();
+}
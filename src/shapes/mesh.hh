@@ -0,0 +1,82 @@
+#ifndef MESH_H_
+#define MESH_H_
+
+#include "ver.hh"
+#include "shapes/primitive.hh"
+#include "shapes/triangle.hh"
+#include "accelerators/bvh.hh"
+#include "accelerators/wbvh.hh"
+#include "accelerators/packed.hh"
+#include "utils/mapped.hh"
+
+// A whole triangle mesh with a single material. Triangles are not primitives
+// on their own: the mesh keeps its own BVH whose leaves are ranges of
+// TrianglePacks, the mesh itself is only read for shading. The BVH is
+// binary or collapsed into 4/8-wide nodes, as given by BVHConfig::width.
+class TriangleMeshPrimitive : public Primitive {
+  public:
+    TriangleMeshPrimitive(const std::shared_ptr<TriangleMesh> &mesh_,
+                          const std::shared_ptr<IMaterial> &material_,
+                          const BVHConfig &config = BVHConfig());
+
+    TriangleMeshPrimitive(const TriangleMeshPrimitive &) = delete;
+    TriangleMeshPrimitive &operator=(const TriangleMeshPrimitive &) = delete;
+
+    // Loads a PLY mesh. With config.cacheDir set, the transformed mesh and its
+    // BVH are kept there in a file keyed by a hash of the PLY path, size and
+    // modification time, the transform and the build settings, later loads
+    // map that file instead of parsing the PLY and building the BVH again.
+    static std::unique_ptr<TriangleMeshPrimitive> load(const std::string &filename, const Mat4 &transform,
+                                                       const std::shared_ptr<IMaterial> &material,
+                                                       const BVHConfig &config = BVHConfig());
+
+    Bounds bounds() const override;
+    bool intersect(const Ray &ray, HitRecord &hit) const override;
+    bool intersectP(const Ray &ray) const override;
+    void interaction(const Ray &ray, const HitRecord &hit,
+                     SurfaceInteraction &interact) const override;
+    void intersectPacket(RayPacket &packet, uint32_t lanes, HitRecord hits[]) const override;
+    uint32_t intersectPPacket(const RayPacket &packet, uint32_t lanes) const override;
+
+    BVHStats stats(const BVHConfig &config = BVHConfig()) const;
+
+  private:
+    // Nodes and packs are used in place from the mapped cache file, fromCache
+    // points the tree at them
+    TriangleMeshPrimitive(const std::shared_ptr<TriangleMesh> &mesh_,
+                          const std::shared_ptr<IMaterial> &material_,
+                          std::unique_ptr<MappedFile> &&file);
+
+    // Calls f(nodes, nNodes) with the nodes of the tree, whatever its width
+    template <typename F>
+    decltype(auto) withNodes(F &&f) const {
+      if (nodes4) return f(nodes4, nNodes);
+      if (nodes8) return f(nodes8, nNodes);
+      return f(nodes, nNodes);
+    }
+
+    // Returns nullptr if file is not a valid cache for key
+    static std::unique_ptr<TriangleMeshPrimitive> fromCache(std::unique_ptr<MappedFile> &&file, uint64_t key,
+                                                            const std::shared_ptr<IMaterial> &material);
+    void save(const std::string &filename, uint64_t key) const;
+
+  private:
+    std::shared_ptr<TriangleMesh> mesh;
+    std::shared_ptr<IMaterial> material;
+    // Backing storage of nodes and packs, either built here or a cache file
+    std::vector<LinearBVHNode> ownedNodes;
+    std::vector<WideBVHNode<4>> ownedNodes4;
+    std::vector<WideBVHNode<8>> ownedNodes8;
+    std::vector<TrianglePack> ownedPacks;
+    std::unique_ptr<MappedFile> cache;
+
+    // Only the nodes of the width of the tree are set
+    const LinearBVHNode *nodes;
+    const WideBVHNode<4> *nodes4;
+    const WideBVHNode<8> *nodes8;
+    size_t nNodes;
+    const TrianglePack *packs;
+    size_t nPacks;
+};
+
+#endif // MESH_H_
@@ -1,17 +1,39 @@
 #include "primitive.hh"
 #include "materials/material.hh"
 
+void Primitive::intersectPacket(RayPacket &packet, uint32_t lanes, HitRecord hits[]) const {
+  for (int i = 0; i < packetSize; i++)
+    if ((lanes & (1u << i)) && intersect(packet.rays[i], hits[i]))
+      packet.shrink(i);
+}
+
+uint32_t Primitive::intersectPPacket(const RayPacket &packet, uint32_t lanes) const {
+  uint32_t blocked = 0;
+  for (int i = 0; i < packetSize; i++)
+    if ((lanes & (1u << i)) && intersectP(packet.rays[i]))
+      blocked |= 1u << i;
+  return blocked;
+}
+
 GeometricPrimitive::GeometricPrimitive(const std::shared_ptr<Shape> &shape_,
                                        const std::shared_ptr<IMaterial> &material_) 
   : shape{shape_}, material{material_} {}
 
 Bounds GeometricPrimitive::bounds() const { return shape->bounds(); }
 
-bool GeometricPrimitive::intersect(const Ray &ray, SurfaceInteraction &interact) const {
-  Float tHit;
-  if (!shape->intersect(ray, tHit, interact)) return false;
+bool GeometricPrimitive::intersect(const Ray &ray, HitRecord &hit) const {
+  if (!shape->intersect(ray, hit)) return false;
 
-  interact.material = material;
-  // TODO: change normals if normal map in material
+  ray.tMax = hit.t;
+  hit.primitive = this;
   return true;
 }
+
+bool GeometricPrimitive::intersectP(const Ray &ray) const { return shape->intersect(ray); }
+
+void GeometricPrimitive::interaction(const Ray &ray, const HitRecord &hit,
+                                     SurfaceInteraction &interact) const {
+  shape->interaction(ray, hit, interact);
+  interact.material = material.get();
+  // TODO: change normals if normal map in material
+}
@@ -5,11 +5,24 @@
 #include "geometry.hh"
 #include "shapes/shape.hh"
 #include "interaction.hh"
+#include "packet.hh"
 
 class Primitive {
   public:
     virtual Bounds bounds() const = 0;
-    virtual bool intersect(const Ray &ray, SurfaceInteraction &interact) const = 0;
+    // Closest-hit query, on hit ray.tMax is shrunk to hit.t
+    virtual bool intersect(const Ray &ray, HitRecord &hit) const = 0;
+    // Any-hit query, returns at the first hit in [ray.tMin, ray.tMax]
+    virtual bool intersectP(const Ray &ray) const = 0;
+    // Shading data of a hit returned by intersect
+    virtual void interaction(const Ray &ray, const HitRecord &hit,
+                             SurfaceInteraction &interact) const = 0;
+    // Closest-hit query for the given lanes of a packet, hits[i] and the
+    // tMax of lane i are updated as intersect would. By default every lane
+    // is traced on its own.
+    virtual void intersectPacket(RayPacket &packet, uint32_t lanes, HitRecord hits[]) const;
+    // Any-hit query for the given lanes of a packet, returns the lanes blocked
+    virtual uint32_t intersectPPacket(const RayPacket &packet, uint32_t lanes) const;
     // virtual std::shared_ptr<Material> material() const = 0;
 };
 
@@ -19,7 +32,10 @@ class GeometricPrimitive : public Primitive {
                        const std::shared_ptr<IMaterial> &material_);
 
     Bounds bounds() const override;
-    bool intersect(const Ray &ray, SurfaceInteraction &interact) const override;
+    bool intersect(const Ray &ray, HitRecord &hit) const override;
+    bool intersectP(const Ray &ray) const override;
+    void interaction(const Ray &ray, const HitRecord &hit,
+                     SurfaceInteraction &interact) const override;
     // std::shared_ptr<Material> material() const override;
   private:
     std::shared_ptr<Shape> shape;
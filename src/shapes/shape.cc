@@ -1,7 +1,6 @@
 #include "shape.hh"
 
 bool Shape::intersect(const Ray &ray) const {
-  Float tHit;
-  SurfaceInteraction interact;
-  return intersect(ray, tHit, interact);
+  HitRecord hit;
+  return intersect(ray, hit);
 }
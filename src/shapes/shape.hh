@@ -8,8 +8,12 @@
 class Shape {
   public:
     virtual Bounds bounds() const = 0;
-    virtual bool intersect(const Ray &ray, Float &tHit,
-                           SurfaceInteraction &interact) const = 0;
+    // Fills t (and barycentrics) of hit if the ray hits in [ray.tMin, ray.tMax]
+    virtual bool intersect(const Ray &ray, HitRecord &hit) const = 0;
+    // Computes the shading data of a hit previously found with intersect
+    virtual void interaction(const Ray &ray, const HitRecord &hit,
+                             SurfaceInteraction &interact) const = 0;
+    // Occlusion test, true if there is any hit in [ray.tMin, ray.tMax]
     virtual bool intersect(const Ray &ray) const;
     virtual Float area() const = 0;
 };
@@ -8,8 +8,7 @@ Bounds Sphere::bounds() const {
   return Bounds(o+min, o+max);
 }
 
-bool Sphere::intersect(const Ray &ray, Float &tHit,
-                       SurfaceInteraction &interact) const {
+bool Sphere::intersect(const Ray &ray, HitRecord &hit) const {
   // https://link.springer.com/content/pdf/10.1007/978-1-4842-4427-2_7.pdf#0004286892.INDD%3AAnchor%2019%3A19
   Point G = o;
   Direction f = ray.o - G;
@@ -28,10 +27,23 @@ bool Sphere::intersect(const Ray &ray, Float &tHit,
   Float t1 = q;
 
   if (t1 < t0) std::swap(t0, t1); // t0 will be less than or equal to t1
-  if (t1 <= 0) return false;
+  if (t0 >= ray.tMax || t1 <= ray.tMin) return false;
 
-  tHit = (t0 <= 0) ? t1 : t0;
+  Float tHit = t0;
+  if (tHit <= ray.tMin) {
+    tHit = t1;
+    if (tHit >= ray.tMax) return false;
+  }
 
+  hit.t = tHit;
+  return true;
+}
+
+void Sphere::interaction(const Ray &ray, const HitRecord &hit,
+                         SurfaceInteraction &interact) const {
+  const Float tHit = hit.t;
+
+  const Point G = o;
   interact.n = (ray(tHit) - G) / r;
 
   // TODO:remove
@@ -55,8 +67,6 @@ bool Sphere::intersect(const Ray &ray, Float &tHit,
   // // Partial derivatives w.r.t. theta and phi
   // interact.du = Direction(-v.y, v.x, 0).normalize();
   // interact.dv = Direction(v.x * v.z, v.y * v.z, -std::sqrt(v.x * v.x + v.y * v.y)).normalize();
-  
-  return true;
 }
 
 Float Sphere::area() const {
@@ -7,10 +7,14 @@ class Sphere : public Shape {
   public:
     Sphere(const Point &origin, Float radius);
     Bounds bounds() const override;
-    bool intersect(const Ray &ray, Float &tHit,
-                   SurfaceInteraction &interact) const override;
+    bool intersect(const Ray &ray, HitRecord &hit) const override;
+    void interaction(const Ray &ray, const HitRecord &hit,
+                     SurfaceInteraction &interact) const override;
     Float area() const override;
 
+    const Point &center() const { return o; }
+    Float radius() const { return r; }
+
   private:
     Point o;
     Float r;
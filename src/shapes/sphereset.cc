@@ -0,0 +1,70 @@
+#include "sphereset.hh"
+#include "materials/material.hh"
+
+SphereSetPrimitive::SphereSetPrimitive(std::vector<Sphere> &&spheres_,
+                                       std::vector<std::shared_ptr<IMaterial>> &&materials_,
+                                       const BVHConfig &config)
+  : spheres{std::move(spheres_)}, materials{std::move(materials_)}, packs{}, nodes{} {
+  assert(spheres.size() == materials.size(), "Every sphere needs a material");
+  if (spheres.empty()) return;
+
+  std::vector<BVHPrimitiveInfo> sphereInfo(spheres.size());
+  for (size_t i = 0; i < spheres.size(); i++)
+    sphereInfo[i] = BVHPrimitiveInfo(i, spheres[i].bounds());
+
+  nodes = buildBVH(sphereInfo, config);
+
+  SpherePack empty{};
+  std::fill(std::begin(empty.r2), std::end(empty.r2), -1.0f); // Never hit
+
+  packs = packLeaves(nodes, sphereInfo, empty, [&](SpherePack &pack, int lane, size_t sphere) {
+    for (int a = 0; a < 3; a++)
+      pack.c[a][lane] = static_cast<float>(spheres[sphere].center()[a]);
+    pack.r2[lane] = static_cast<float>(spheres[sphere].radius() * spheres[sphere].radius());
+    pack.id[lane] = sphere;
+  });
+}
+
+Bounds SphereSetPrimitive::bounds() const { return nodes.empty() ? Bounds() : nodes[0].bounds; }
+
+bool SphereSetPrimitive::intersect(const Ray &ray, HitRecord &hit) const {
+  const PackRay r(ray);
+
+  return traverseBVH<false>(nodes.data(), nodes.size(), ray, [&](uint offset, uint nPrims) {
+    bool leafHit = false;
+    for (uint k = offset; k < offset + (nPrims + packWidth - 1) / packWidth; k++) {
+      float t[packWidth];
+      const int mask = intersectPack(packs[k], r, ray.tMin, ray.tMax, t);
+      if (!mask) continue;
+
+      for (int i = 0; i < packWidth; i++) {
+        if (!(mask & (1 << i)) || t[i] >= ray.tMax) continue;
+        ray.tMax = t[i];
+        hit.t = t[i];
+        hit.primitive = this;
+        hit.primID = packs[k].id[i];
+        leafHit = true;
+      }
+    }
+    return leafHit;
+  });
+}
+
+bool SphereSetPrimitive::intersectP(const Ray &ray) const {
+  const PackRay r(ray);
+
+  return traverseBVH<true>(nodes.data(), nodes.size(), ray, [&](uint offset, uint nPrims) {
+    for (uint k = offset; k < offset + (nPrims + packWidth - 1) / packWidth; k++) {
+      float t[packWidth];
+      if (intersectPack(packs[k], r, ray.tMin, ray.tMax, t))
+        return true;
+    }
+    return false;
+  });
+}
+
+void SphereSetPrimitive::interaction(const Ray &ray, const HitRecord &hit,
+                                     SurfaceInteraction &interact) const {
+  spheres[hit.primID].interaction(ray, hit, interact);
+  interact.material = materials[hit.primID].get();
+}
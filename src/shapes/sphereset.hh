@@ -0,0 +1,31 @@
+#ifndef SPHERESET_H_
+#define SPHERESET_H_
+
+#include "ver.hh"
+#include "shapes/primitive.hh"
+#include "shapes/sphere.hh"
+#include "accelerators/bvh.hh"
+#include "accelerators/packed.hh"
+
+// A group of spheres, each with its own material, intersected through
+// SpherePacks in the leaves of its own BVH. The Spheres are only used for shading.
+class SphereSetPrimitive : public Primitive {
+  public:
+    SphereSetPrimitive(std::vector<Sphere> &&spheres_,
+                       std::vector<std::shared_ptr<IMaterial>> &&materials_,
+                       const BVHConfig &config = BVHConfig());
+
+    Bounds bounds() const override;
+    bool intersect(const Ray &ray, HitRecord &hit) const override;
+    bool intersectP(const Ray &ray) const override;
+    void interaction(const Ray &ray, const HitRecord &hit,
+                     SurfaceInteraction &interact) const override;
+
+  private:
+    std::vector<Sphere> spheres;
+    std::vector<std::shared_ptr<IMaterial>> materials;
+    std::vector<SpherePack> packs;
+    std::vector<LinearBVHNode> nodes;
+};
+
+#endif // SPHERESET_H_
@@ -111,32 +111,39 @@ TriangleMesh::TriangleMesh(const Mat4 &transform, std::vector<size_t> &vertexInd
 
 }
 
+TriangleMesh::TriangleMesh(std::vector<size_t> &&vertexIndices, std::vector<Point> &&P,
+                           std::vector<Direction> &&N, std::vector<Direction> &&S,
+                           std::vector<Vec2> &&UV)
+  : nTriangles{vertexIndices.size() / 3}, nVertices{P.size()}, indices{std::move(vertexIndices)},
+    p{std::move(P)}, n{std::move(N)}, s{std::move(S)}, uv{std::move(UV)} {}
+
+void TriangleMesh::interaction(size_t v0, size_t v1, size_t v2, const Ray &ray,
+                               const HitRecord &hit, SurfaceInteraction &interact) const {
+  const Float t = hit.t, u = hit.b1, v = hit.b2;
+  const Float w = 1.0 - u - v;
 
-Triangle::Triangle(const std::shared_ptr<TriangleMesh> &triangleMesh, size_t triangle)
-  : mesh{triangleMesh}, v{&mesh->indices[3 * triangle]} { }
+  // 3. Compute intersection information
+  Vec2 uvHit;
+  if (uv.empty())
+    uvHit = Vec2(0, 0) * w + Vec2(1, 0) * u + Vec2(1, 1) * v;
+  else
+    uvHit = uv[v0] * w + uv[v1] * u + uv[v2] * v;
 
-Bounds Triangle::bounds() const {
-  // TODO: transformation??
-  const Point &p0 = mesh->p[v[0]];
-  const Point &p1 = mesh->p[v[1]];
-  const Point &p2 = mesh->p[v[2]];
-  // std::cout << "p0: " << p0 << std::endl;
-  // std::cout << "p1: " << p1 << std::endl;
-  // std::cout << "p2: " << p2 << std::endl;
-  // std::cout << Bounds(p0).Union(p1).Union(p2) << std::endl;
-  // std::cout << Bounds(p0).Union(p1).Union(p2).volume() << std::endl << std::endl;
-  return Bounds(p0).Union(p1).Union(p2);
+  interact.p = ray(t);
+  interact.t = t;
+  interact.n = n[v0]; // TODO: improve 
+  interact.wo = -ray.d;
+  interact.entering = interact.n.dot(ray.d) < 0;
+
+  interact.u = uvHit[0];
+  interact.v = uvHit[1];
 }
 
 // https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
-bool Triangle::intersect(const Ray &ray, Float &tHit,
-                         SurfaceInteraction &interact) const {
+bool intersectTriangle(const Ray &ray, const Point &p0, const Point &p1, const Point &p2,
+                       HitRecord &hit) {
   constexpr Float eps = std::numeric_limits<Float>::epsilon();
 
-  const Point &p0 = mesh->p[this->v[0]];
-  const Point &p1 = mesh->p[this->v[1]];
-  const Point &p2 = mesh->p[this->v[2]];
-
   // 1. Check if ray intersects triangle plane
   const Direction e1 = p1 - p0;
   const Direction e2 = p2 - p0;
@@ -169,29 +176,39 @@ bool Triangle::intersect(const Ray &ray, Float &tHit,
   const Float v = ray.d.dot(ray_x_e1) * inv_det;
   if (v < 0.0 || u + v > 1.0) return false;
 
-  const Float w = 1.0 - u - v;
-
   const Float t = e2.dot(ray_x_e1) * inv_det;
+  if (t <= ray.tMin || t >= ray.tMax) return false; // outside the ray interval
 
-  if (t < eps) return false; // triangle behind ray
+  hit.t = t;
+  hit.b1 = u;
+  hit.b2 = v;
+  return true;
+}
 
-  // 3. Compute intersection information
-  Vec2 uv[3];
-  getUVs(uv);
 
-  Vec2 uvHit = uv[0] * w + uv[1] * u + uv[2] * v;
+Triangle::Triangle(const std::shared_ptr<TriangleMesh> &triangleMesh, size_t triangle)
+  : mesh{triangleMesh}, v{&mesh->indices[3 * triangle]} { }
 
-  tHit = t;
-  interact.p = ray(t);
-  interact.t = t;
-  interact.n = mesh->n[this->v[0]]; // TODO: improve 
-  interact.wo = -ray.d;
-  interact.entering = interact.n.dot(ray.d) < 0;
+Bounds Triangle::bounds() const {
+  // TODO: transformation??
+  const Point &p0 = mesh->p[v[0]];
+  const Point &p1 = mesh->p[v[1]];
+  const Point &p2 = mesh->p[v[2]];
+  // std::cout << "p0: " << p0 << std::endl;
+  // std::cout << "p1: " << p1 << std::endl;
+  // std::cout << "p2: " << p2 << std::endl;
+  // std::cout << Bounds(p0).Union(p1).Union(p2) << std::endl;
+  // std::cout << Bounds(p0).Union(p1).Union(p2).volume() << std::endl << std::endl;
+  return Bounds(p0).Union(p1).Union(p2);
+}
 
-  interact.u = uvHit[0];
-  interact.v = uvHit[1];
+bool Triangle::intersect(const Ray &ray, HitRecord &hit) const {
+  return intersectTriangle(ray, mesh->p[v[0]], mesh->p[v[1]], mesh->p[v[2]], hit);
+}
 
-  return true;
+void Triangle::interaction(const Ray &ray, const HitRecord &hit,
+                           SurfaceInteraction &interact) const {
+  mesh->interaction(v[0], v[1], v[2], ray, hit, interact);
 }
 
 Float Triangle::area() const {
@@ -200,16 +217,4 @@ Float Triangle::area() const {
   const Point &p2 = mesh->p[v[2]];
 
   return 0.5 * (p1 - p0).cross(p2 - p0).norm();
-}
-
-void Triangle::getUVs(Vec2 uv[3]) const {
-  if (mesh->uv.empty()) {
-    uv[0] = Vec2(0, 0);
-    uv[1] = Vec2(1, 0);
-    uv[2] = Vec2(1, 1);
-  } else {
-    uv[0] = mesh->uv[v[0]];
-    uv[1] = mesh->uv[v[1]];
-    uv[2] = mesh->uv[v[2]];
-  }
 }
\ No newline at end of file
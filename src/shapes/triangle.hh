@@ -13,12 +13,20 @@ struct TriangleMesh {
                std::vector<Direction> &N,
                std::vector<Direction> &S,
                std::vector<Vec2> &UV);
+  // Takes vertex data that is already transformed, e.g. read from a cache
+  TriangleMesh(std::vector<size_t> &&vertexIndices, std::vector<Point> &&P,
+               std::vector<Direction> &&N, std::vector<Direction> &&S,
+               std::vector<Vec2> &&UV);
 
   TriangleMesh(const TriangleMesh &) = delete;
   TriangleMesh &operator=(const TriangleMesh &) = delete;
   TriangleMesh(TriangleMesh &&) = delete;
   TriangleMesh &operator=(TriangleMesh &&) = delete;
 
+  // Shading data of a hit on the triangle with vertices v0, v1 and v2
+  void interaction(size_t v0, size_t v1, size_t v2, const Ray &ray,
+                   const HitRecord &hit, SurfaceInteraction &interact) const;
+
   /*const*/ size_t nTriangles, nVertices;
   std::vector<size_t> indices;
   std::vector<Point> p;
@@ -27,19 +35,21 @@ struct TriangleMesh {
   std::vector<Vec2> uv;
 };
 
+// Ray-triangle test, on hit fills t and the barycentrics of p1 and p2
+bool intersectTriangle(const Ray &ray, const Point &p0, const Point &p1, const Point &p2,
+                       HitRecord &hit);
 
 class Triangle : public Shape {
   public:
     Triangle(const std::shared_ptr<TriangleMesh> &mesh, size_t triangle);
 
     Bounds bounds() const override;
-    bool intersect(const Ray &ray, Float &tHit,
-                   SurfaceInteraction &interact) const override;
+    bool intersect(const Ray &ray, HitRecord &hit) const override;
+    void interaction(const Ray &ray, const HitRecord &hit,
+                     SurfaceInteraction &interact) const override;
     Float area() const override;
 
   private:
-    void getUVs(Vec2 uv[3]) const;
-
     std::shared_ptr<TriangleMesh> mesh;
     const size_t *v;
 };
@@ -0,0 +1,66 @@
+#include "mapped.hh"
+#include <fstream>
+#include <stdexcept>
+
+#ifndef MAPPED_NO_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace utils {
+#ifndef MAPPED_NO_MMAP
+  MappedFile::MappedFile(const std::string &filename) : ptr{nullptr}, length{0} {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("Failed to open file: " + filename + "\n");
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      close(fd);
+      throw std::runtime_error("Failed to stat file: " + filename + "\n");
+    }
+
+    length = st.st_size;
+    if (length > 0) {
+      void *mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error("Failed to map file: " + filename + "\n");
+      }
+      ptr = static_cast<const char *>(mapping);
+    }
+    // The mapping stays valid once the descriptor is closed
+    close(fd);
+  }
+
+  MappedFile::~MappedFile() {
+    if (ptr) munmap(const_cast<char *>(ptr), length);
+  }
+#else
+  MappedFile::MappedFile(const std::string &filename) : ptr{nullptr}, length{0} {
+    std::ifstream file(filename, std::ifstream::binary | std::ifstream::ate);
+    if (!file.is_open())
+      throw std::runtime_error("Failed to open file: " + filename + "\n");
+
+    buffer.resize(file.tellg());
+    file.seekg(0);
+    file.read(buffer.data(), buffer.size());
+    ptr = buffer.data();
+    length = buffer.size();
+  }
+
+  MappedFile::~MappedFile() {}
+#endif
+
+  uint64_t hash(const void *data, size_t size, uint64_t seed) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint64_t h = seed;
+    for (size_t i = 0; i < size; i++) {
+      h ^= bytes[i];
+      h *= 1099511628211ull;
+    }
+    return h;
+  }
+}
@@ -0,0 +1,39 @@
+#ifndef MAPPED_H_
+#define MAPPED_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__) || defined(EMSCRIPTEN)
+#define MAPPED_NO_MMAP
+#endif
+
+namespace utils {
+  // Read-only view of a whole file. It is memory-mapped where mmap is
+  // available and read into memory otherwise.
+  class MappedFile {
+    public:
+      explicit MappedFile(const std::string &filename);
+      ~MappedFile();
+
+      MappedFile(const MappedFile &) = delete;
+      MappedFile &operator=(const MappedFile &) = delete;
+
+      const char *data() const { return ptr; }
+      size_t size() const { return length; }
+
+    private:
+      const char *ptr;
+      size_t length;
+#ifdef MAPPED_NO_MMAP
+      std::vector<char> buffer;
+#endif
+  };
+
+  // 64-bit FNV-1a, calls can be chained by passing the previous hash as seed
+  uint64_t hash(const void *data, size_t size, uint64_t seed = 14695981039346656037ull);
+}
+
+#endif // MAPPED_H_
@@ -0,0 +1,93 @@
+#include "telemetry.hh"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) || defined(__NT__)
+#include <io.h>
+#define isatty _isatty
+#define fileno _fileno
+#else
+#include <unistd.h>
+#endif
+
+namespace utils {
+  namespace {
+    // 1234567 -> 1.23M
+    std::string human(double value) {
+      const char *suffixes[] = {"", "k", "M", "G", "T"};
+      int i = 0;
+      while (value >= 1000 && i < 4) {
+        value /= 1000;
+        i++;
+      }
+      std::stringstream ss;
+      ss << std::fixed << std::setprecision(i > 0 ? 2 : 0) << value << suffixes[i];
+      return ss.str();
+    }
+  } // namespace
+
+  Telemetry::Counters Telemetry::counters[Telemetry::maxThreads];
+
+  Telemetry::Telemetry(uint64_t totalSamples, const std::string &description, std::chrono::milliseconds interval)
+    : total{totalSamples}, desc{description}, base{totals()}, start{std::chrono::steady_clock::now()},
+      terminal{isatty(fileno(stdout)) != 0}, done{false} {
+    if (desc.size() > 0) desc += ": ";
+
+    const std::chrono::milliseconds every = terminal ? interval : std::max<std::chrono::milliseconds>(interval, logInterval);
+    reporter = std::thread([this, every]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (!wake.wait_for(lock, every, [this]() { return done; }))
+        report(false);
+    });
+  }
+
+  Telemetry::~Telemetry() { finish(); }
+
+  void Telemetry::finish() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (done) return;
+      done = true;
+    }
+    wake.notify_one();
+    reporter.join();
+    report(true);
+  }
+
+  Telemetry::Totals Telemetry::totals() {
+    Totals sum;
+    for (const Counters &c : counters) {
+      sum.samples += c.samples.load(std::memory_order_relaxed);
+      sum.rays += c.rays.load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+  void Telemetry::report(bool last) const {
+    constexpr int barLength = 30;
+
+    const Totals now = totals();
+    const uint64_t samples = now.samples - base.samples;
+    const uint64_t rays = now.rays - base.rays;
+    const uint64_t totalSamples = total.load(std::memory_order_relaxed);
+    const double elapsed = std::max(1e-6, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    const double fraction = (totalSamples > 0) ? std::min(1.0, static_cast<double>(samples) / totalSamples) : 1.0;
+    const double eta = (samples > 0) ? elapsed / samples * (totalSamples - std::min(samples, totalSamples)) : 0.0;
+
+    std::stringstream ss;
+    if (terminal) ss << "\r\033[K";
+    ss << desc << std::setw(3) << static_cast<int>(fraction * 100) << "% |";
+    for (int i = 0; i < barLength; i++)
+      ss << (i < static_cast<int>(fraction * barLength) ? '#' : ' ');
+    ss << "| " << samples << "/" << totalSamples;
+    ss << std::fixed << std::setprecision(2) << " [" << elapsed << "s, ETA " << eta << "s, "
+       << human(samples / elapsed) << " samples/s, " << human(rays / elapsed) << " rays/s]";
+
+    std::cout << ss.str() << std::flush;
+    if (last || !terminal) std::cout << std::endl;
+  }
+} // namespace utils
@@ -0,0 +1,86 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace utils {
+  // Progress of the render loops. Threads count the samples and rays they
+  // trace in their own cache line, without locks, and a reporter thread sums
+  // the counters a few times per second to print progress, samples/s, rays/s
+  // and the ETA. Counters are global, every Telemetry reports what was done
+  // since it was created. The progress line is redrawn in place only on a
+  // terminal, redirected output gets a plain line every logInterval and the
+  // final one.
+  class Telemetry {
+    public:
+      Telemetry(uint64_t totalSamples, const std::string &description = "",
+                std::chrono::milliseconds interval = std::chrono::milliseconds(500));
+      ~Telemetry();
+
+      Telemetry(const Telemetry &) = delete;
+      Telemetry &operator=(const Telemetry &) = delete;
+
+      // For renders whose amount of work is only known as they go
+      void setTotal(uint64_t totalSamples) { total.store(totalSamples, std::memory_order_relaxed); }
+
+      // Stops the reporter and prints the final figures, only the first call
+      // does anything
+      void finish();
+
+      static constexpr std::chrono::seconds logInterval{60};
+
+      static void addSamples(uint64_t n) { local().samples.fetch_add(n, std::memory_order_relaxed); }
+      static void addRays(uint64_t n) { local().rays.fetch_add(n, std::memory_order_relaxed); }
+
+      struct Totals {
+        uint64_t samples = 0;
+        uint64_t rays = 0;
+      };
+      // Sum over all the threads since the program started
+      static Totals totals();
+
+    private:
+      struct alignas(64) Counters {
+        std::atomic<uint64_t> samples{0};
+        std::atomic<uint64_t> rays{0};
+      };
+      // Threads beyond this share slots, which is still correct
+      static constexpr size_t maxThreads = 256;
+      static Counters counters[maxThreads];
+
+      static Counters &local() {
+#ifdef _OPENMP
+        return counters[omp_get_thread_num() % maxThreads];
+#else
+        return counters[0];
+#endif
+      }
+
+      void report(bool last) const;
+
+    private:
+      std::atomic<uint64_t> total;
+      std::string desc;
+      Totals base; // totals() at construction
+      std::chrono::time_point<std::chrono::steady_clock> start;
+      bool terminal; // Whether stdout is one, so the line can be redrawn
+
+      std::thread reporter;
+      std::mutex mutex;
+      std::condition_variable wake;
+      bool done;
+  };
+} // namespace utils
+
+#endif // TELEMETRY_H_
@@ -0,0 +1,61 @@
+#include "tiles.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <stdint.h>
+
+namespace utils {
+  namespace {
+    // Interleaves the bits of x and y
+    uint64_t morton(uint32_t x, uint32_t y) {
+      uint64_t code = 0;
+      for (int b = 0; b < 32; b++)
+        code |= (static_cast<uint64_t>((x >> b) & 1) << (2 * b)) | (static_cast<uint64_t>((y >> b) & 1) << (2 * b + 1));
+      return code;
+    }
+  } // namespace
+
+  TileScheduler::TileScheduler(size_t width, size_t height, const TileConfig &config) {
+    if (config.size == 0)
+      throw std::runtime_error("Tile size must be positive");
+
+    const size_t nx = (width + config.size - 1) / config.size;
+    const size_t ny = (height + config.size - 1) / config.size;
+
+    // Sort keys of every tile, (ring, angle) for spirals
+    std::vector<std::pair<double, double>> keys;
+    std::vector<size_t> order;
+    for (size_t ty = 0; ty < ny; ty++) {
+      for (size_t tx = 0; tx < nx; tx++) {
+        const double dx = tx + 0.5 - nx * 0.5, dy = ty + 0.5 - ny * 0.5;
+        switch (config.order) {
+          case TileOrder::Scanline:
+            keys.emplace_back(ty * nx + tx, 0);
+            break;
+          case TileOrder::Morton:
+            keys.emplace_back(morton(tx, ty), 0);
+            break;
+          case TileOrder::Spiral:
+            keys.emplace_back(std::max(std::abs(dx), std::abs(dy)), std::atan2(dy, dx));
+            break;
+        }
+        order.push_back(order.size());
+      }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+    tiles.reserve(order.size());
+    for (size_t i : order) {
+      const size_t x0 = (i % nx) * config.size, y0 = (i / nx) * config.size;
+      tiles.push_back({x0, y0, std::min(config.size, width - x0), std::min(config.size, height - y0)});
+    }
+  }
+
+  void TileScheduler::stride(size_t first, size_t step) {
+    std::vector<Tile> kept;
+    for (size_t i = first; i < tiles.size(); i += step)
+      kept.push_back(tiles[i]);
+    tiles = std::move(kept);
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef TILES_H_
+#define TILES_H_
+
+#include <vector>
+#include <stddef.h>
+
+namespace utils {
+  // Order in which tiles are handed out: row by row, along a Morton curve
+  // (neighbouring tiles close in time, so they share cache), or in rings from
+  // the center of the image out (the interesting part shows up first)
+  enum class TileOrder { Scanline, Morton, Spiral };
+
+  struct TileConfig {
+    size_t size = 16; // Side in pixels
+    TileOrder order = TileOrder::Morton;
+  };
+
+  // Pixels [x0, x0 + width) x [y0, y0 + height), tiles on the right and bottom
+  // edges of the image may be smaller than the tile size
+  struct Tile {
+    size_t x0, y0;
+    size_t width, height;
+  };
+
+  // Splits an image into tiles and distributes them between the OpenMP
+  // threads: each thread takes the next tile in order as soon as it is done
+  // with its previous one, so expensive regions do not stall the others
+  class TileScheduler {
+    public:
+      TileScheduler(size_t width, size_t height, const TileConfig &config = TileConfig());
+
+      size_t size() const { return tiles.size(); }
+      const Tile &operator[](size_t i) const { return tiles[i]; }
+
+      // Only keeps tiles first, first + step, first + 2 step, ... of the
+      // order, to split an image between processes
+      void stride(size_t first, size_t step);
+
+      // Calls render(tile) for the tiles [first, last) in parallel
+      template <typename Render>
+      void run(size_t first, size_t last, Render &&render) const {
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (size_t i = first; i < last; i++)
+          render(tiles[i]);
+      }
+
+      template <typename Render>
+      void run(Render &&render) const { run(0, size(), render); }
+
+    private:
+      std::vector<Tile> tiles;
+  };
+}
+
+#endif // TILES_H_
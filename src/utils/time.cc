@@ -10,6 +10,7 @@ namespace utils {
       auto minutes = std::chrono::duration_cast<std::chrono::minutes>(millis);
       millis -= minutes;
       auto seconds = std::chrono::duration_cast<std::chrono::seconds>(millis);
+      millis -= seconds;
 
       std::stringstream ss;
 
@@ -17,7 +18,7 @@ namespace utils {
       ss << std::setw(2) << hours.count() << ":";
       ss << std::setw(2) << minutes.count() << ":";
       ss << std::setw(2) << seconds.count() << ".";
-      ss << std::setw(2) << millis.count();
+      ss << std::setw(3) << millis.count();
 
       return ss.str();
     }
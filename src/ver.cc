@@ -1,11 +1,14 @@
 #include "ver.hh"
 #include "geometry.hh"
+#include "image/accumulation.hh"
 #include "image/io.hh"
 #include "image/film.hh"
 #include "image/tonemap.hh"
 #include "integrators/pathtracer.hh"
 #include "integrators/photonmapper.hh"
+#include "integrators/wavefront.hh"
 #include "utils/argparse.hh"
+#include "utils/time.hh"
 #include <chrono>
 
 using namespace utils;
@@ -34,11 +37,11 @@ int ver(int argc, char **argv) {
   ArgumentParser parser("ver", "A simple pathtracer / photonmapper from scratch (with tonemappers)");
 
   parser.addArgument("integrator", "Integrator to use")
-    .choices({"pathtracer", "photonmapper"})
+    .choices({"pathtracer", "photonmapper", "wavefront"})
     .default_value("pathtracer");
 
   parser.addArgument("--scene", "Scene to render")
-    .choices({"cornellbox", "cornellboxA", "bunny", "orb", "nephroid",
+    .choices({"cornellbox", "cornellboxA", "bunny", "bunnies", "orb", "nephroid",
               "cornellboxDiffuse", "cornellboxDiffuseA",
               "cornellboxTeapot", "cornellboxLucy", "cornellboxLucyA",
               "cornellboxMonkey", "cornellboxEye"})
@@ -57,12 +60,47 @@ int ver(int argc, char **argv) {
     .choices({"pinhole", "orthographic"})
     .default_value("pinhole");
 
+  parser.addArgument("--adaptive-threshold", "Keep sampling, --spp at a time, the pixels whose relative error is above this, 0 to disable (PathTracer)")
+    .default_value("0");
+
+  parser.addArgument("--max-spp", "With --adaptive-threshold, per pixel sample cap, 0 for none")
+    .default_value("0");
+
+  parser.addArgument("--time-budget", "Render progressively for this many seconds instead of --spp, 0 to disable (PathTracer)")
+    .default_value("0");
+
+  parser.addArgument("--snapshot-every", "With --time-budget, save the image so far as snapshot_<file> every this many seconds, 0 to disable")
+    .default_value("0");
+
+  parser.addArgument("--checkpoint", "Save the render so far to this file every --checkpoint-every seconds and at the end (PathTracer)")
+    .default_value("");
+
+  parser.addArgument("--checkpoint-every", "Seconds between checkpoints, 0 to only save at the end or when stopped")
+    .default_value("300");
+
+  parser.addArgument("--resume", "Carry on the render saved in --checkpoint if the file exists, up to --spp")
+    .default_value("false")
+    .flag();
+
+  parser.addArgument("--shard", "Render part i/N of the image (0 <= i < N) and save its sums and counts to -o instead of an image, for --merge (PathTracer)")
+    .default_value("");
+
+  parser.addArgument("--shard-by", "With --shard, split the sample indices or the tiles between the shards")
+    .choices({"samples", "tiles"})
+    .default_value("samples");
+
   parser.addArgument("-o", "Filename to save the image")
     .default_value("a.ppm");
   
   parser.addArgument("-d", "Max recursion depth")
     .default_value("42");
   
+  parser.addArgument("--rr-depth", "Bounces before Russian roulette can end a path (PathTracer, Wavefront)")
+    .default_value("3");
+
+  parser.addArgument("--rr-threshold", "Throughput below which Russian roulette applies, 0 disables it (PathTracer, Wavefront)")
+    .default_value("1");
+
   parser.addArgument("--photons", "Number of photons to shoot (PhotonMapper)")
     .default_value("1000000");
 
@@ -84,6 +122,10 @@ int ver(int argc, char **argv) {
     .default_value("false")
     .flag();
   
+  parser.addArgument("--samples", "Save samples per pixel image")
+    .default_value("false")
+    .flag();
+
   parser.addArgument("-t", "Tonemap to use")
     .choices({"gamma", "reinhard2002"})
     .default_value("gamma");
@@ -91,6 +133,13 @@ int ver(int argc, char **argv) {
   parser.addArgument("-g", "Gamma value")
     .default_value("2.2");
   
+  parser.addArgument("--seed", "Seed of the random numbers, the same seed gives the same image")
+    .default_value("5489");
+
+  parser.addArgument("--sequence", "Random numbers of the samples, sobol and halton are stratified")
+    .choices({"sobol", "halton", "independent"})
+    .default_value("sobol");
+
   parser.addArgument("--sampler", "Hemisphere sampling method")
     .choices({"solid_angle", "cosine"})
     .default_value("cosine");
@@ -99,10 +148,40 @@ int ver(int argc, char **argv) {
     .default_value("false")
     .flag();
   
+  parser.addArgument("--tile-size", "Side in pixels of the tiles rendered by each thread")
+    .default_value("16");
+
+  parser.addArgument("--tile-order", "Order in which tiles are rendered")
+    .choices({"morton", "spiral", "scanline"})
+    .default_value("morton");
+
   parser.addArgument("--bvh", "Use BVH")
     .default_value("true");
+
+  parser.addArgument("--bvh-split", "BVH split method")
+    .choices({"sah", "middle", "equal", "sbvh"})
+    .default_value("sah");
+
+  parser.addArgument("--bvh-width", "BVH branching factor (4 and 8 use SIMD slab tests)")
+    .choices({"2", "4", "8"})
+    .default_value("2");
+
+  parser.addArgument("--bvh-leaf", "Max primitives per BVH leaf")
+    .default_value("4");
+
+  parser.addArgument("--bvh-traversal-cost", "SAH cost of traversing a BVH node")
+    .default_value("1");
+
+  parser.addArgument("--bvh-intersection-cost", "SAH cost of intersecting a primitive")
+    .default_value("1");
+
+  parser.addArgument("--bvh-split-budget", "Extra triangle references SBVH spatial splits may add, relative to the triangle count")
+    .default_value("0.3");
+
+  parser.addArgument("--bvh-cache", "Directory where mesh BVHs are cached between runs (none if empty)")
+    .default_value("");
   
-  parser.addArgument("--merge", "Merge HDR files into a single one and exit")
+  parser.addArgument("--merge", "Merge --shard files (weighted by their samples) or HDR files (equal weights) into a single image and exit")
     .nargs('*');
 
   // TODO? Camera parameters?
@@ -122,15 +201,49 @@ int ver(int argc, char **argv) {
   const int height = std::stoi(args["--height"][0]);
   const size_t spp = std::stoi(args["--spp"][0]);
   const std::string &camera = args["--camera"][0];
+  const Float adaptiveThreshold = std::stof(args["--adaptive-threshold"][0]);
+  const size_t maxSpp = std::stoi(args["--max-spp"][0]);
+  const Float timeBudget = std::stof(args["--time-budget"][0]);
+  const Float snapshotEvery = std::stof(args["--snapshot-every"][0]);
+  const std::string &checkpointFile = args["--checkpoint"][0];
+  const Float checkpointEvery = std::stof(args["--checkpoint-every"][0]);
+  const bool resume = args["--resume"][0] == "true";
+  const std::string &shardArg = args["--shard"][0];
   const std::string &filename = args["-o"][0];
   const size_t maxDepth = std::stoi(args["-d"][0]);
   const bool saveNormals = args["--normals"][0] == "true";
   const bool saveDepth = args["--depth"][0] == "true";
+  const bool saveSamples = args["--samples"][0] == "true";
   const std::string &tonemap = args["-t"][0];
   const Float gamma = std::stof(args["-g"][0]);
   const HemisphereSampler sampler = (args["--sampler"][0] == "solid_angle") ? SOLID_ANGLE : COSINE;
+  SamplerConfig samplerConfig;
+  samplerConfig.seed = std::stoul(args["--seed"][0]);
+  samplerConfig.sequence = (args["--sequence"][0] == "halton")      ? SampleSequence::Halton
+                         : (args["--sequence"][0] == "independent") ? SampleSequence::Independent
+                                                                    : SampleSequence::Sobol;
   const bool saveHDR = args["--hdr"][0] == "true";
+  utils::TileConfig tiles;
+  tiles.size = std::stoi(args["--tile-size"][0]);
+  tiles.order = (args["--tile-order"][0] == "spiral")   ? utils::TileOrder::Spiral
+              : (args["--tile-order"][0] == "scanline") ? utils::TileOrder::Scanline
+                                                         : utils::TileOrder::Morton;
   const bool useBVH = args["--bvh"][0] == "true";
+  BVHConfig bvhConfig;
+  bvhConfig.splitMethod = (args["--bvh-split"][0] == "middle") ? SplitMethod::Middle
+                        : (args["--bvh-split"][0] == "equal")  ? SplitMethod::EqualCounts
+                        : (args["--bvh-split"][0] == "sbvh")   ? SplitMethod::SBVH
+                                                               : SplitMethod::SAH;
+  bvhConfig.width = std::stoi(args["--bvh-width"][0]);
+  bvhConfig.maxPrimsInNode = std::stoi(args["--bvh-leaf"][0]);
+  bvhConfig.traversalCost = std::stof(args["--bvh-traversal-cost"][0]);
+  bvhConfig.intersectionCost = std::stof(args["--bvh-intersection-cost"][0]);
+  bvhConfig.spatialSplitBudget = std::stof(args["--bvh-split-budget"][0]);
+  bvhConfig.cacheDir = args["--bvh-cache"][0];
+  // Args for pathtracer and wavefront
+  pathtracer::RussianRoulette rr;
+  rr.minDepth = std::stoi(args["--rr-depth"][0]);
+  rr.threshold = std::stof(args["--rr-threshold"][0]);
   // Args for photonmapper
   const size_t N = std::stoi(args["--photons"][0]);
   const size_t k = std::stoi(args["--k"][0]);
@@ -141,68 +254,137 @@ int ver(int argc, char **argv) {
   Scene scene;
   std::cout << "Loading scene..." << std::endl;
   if (scn == "bunny")
-    scene = Bunny(width, height, camera);
+    scene = Bunny(width, height, camera, bvhConfig);
+  else if (scn == "bunnies")
+    scene = Bunnies(width, height, camera, bvhConfig);
   else if (scn == "orb")
-    scene = LTO(width, height, camera);
+    scene = LTO(width, height, camera, bvhConfig);
   else if (scn == "nephroid")
-    scene = Cardioid(width, height, camera);
+    scene = Cardioid(width, height, camera, bvhConfig);
   else if (scn == "cornellboxDiffuse")
-    scene = CornellBox(width, height, camera, 0);
+    scene = CornellBox(width, height, camera, 0, bvhConfig);
   else if (scn == "cornellboxDiffuseA")
-    scene = CornellBox(width, height, camera, 1);
+    scene = CornellBox(width, height, camera, 1, bvhConfig);
   else if (scn == "cornellboxTeapot")
-    scene = CornellBox(width, height, camera, 2);
+    scene = CornellBox(width, height, camera, 2, bvhConfig);
   else if (scn == "cornellboxLucy")
-    scene = CornellBox(width, height, camera, 3);
+    scene = CornellBox(width, height, camera, 3, bvhConfig);
   else if (scn == "cornellboxLucyA")
-    scene = CornellBox(width, height, camera, 4);
+    scene = CornellBox(width, height, camera, 4, bvhConfig);
   else if (scn == "cornellbox")
-    scene = CornellBox(width, height, camera, 5);
+    scene = CornellBox(width, height, camera, 5, bvhConfig);
   else if (scn == "cornellboxA")
-    scene = CornellBox(width, height, camera, 6);
+    scene = CornellBox(width, height, camera, 6, bvhConfig);
   else if (scn == "cornellboxMonkey")
-    scene = CornellBox(width, height, camera, 7);
+    scene = CornellBox(width, height, camera, 7, bvhConfig);
   else if (scn == "cornellboxEye")
-    scene = CornellBoxR(width, height, camera);
+    scene = CornellBoxR(width, height, camera, bvhConfig);
   else
     throw std::runtime_error("(this should not happen) Unknown scene: " + scn);
 
   if (useBVH) {
-    std::cout << "Building BVH..." << std::endl;
-    scene.makeBVH();
+    std::cout << "Building BVH..." << std::flush;
+    auto start = std::chrono::high_resolution_clock::now();
+    scene.makeBVH(bvhConfig);
+    auto stop = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop - start);
+    std::cout << " took: " << utils::time::format(duration) << std::endl;
+    std::cout << "Scene BVH: " << scene.bvhStats() << std::endl;
+    if (!scene.meshes.empty())
+      std::cout << "Mesh BVHs (" << scene.meshes.size() << "): " << scene.meshStats(bvhConfig) << std::endl;
   }
 
-  // Seed
-  #ifdef NDEBUG
-  uint seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-  #else
-  uint seed = 5489u;
-  #endif
+  auto saveColor = [&](image::Film &film, const std::string &name) {
+    if (saveHDR) {
+      image::write(name + ".hdr", film);
+      return;
+    }
 
-  // Render
-  if (integrator == "pathtracer")
-    pathtracer::render(scene.camera, scene, spp, maxDepth, sampler, seed);
-  else if (integrator == "photonmapper")
-    photonmapper::render(scene.camera, scene, spp, maxDepth, N, k, radius, nee, sampler); // TODO: args
-
-  auto &colorFilm = scene.camera->film;
-  auto &normalFilm = scene.camera->nFilm;
-  auto &depthFilm = scene.camera->dFilm;
-  
-  if (saveHDR) {
-    image::write(filename + ".hdr", colorFilm);
-  } else {
     if (tonemap == "gamma")
-      image::tonemap::Gamma(gamma, colorFilm.max()).applyTo(colorFilm);
+      image::tonemap::Gamma(gamma, film.max()).applyTo(film);
     else if (tonemap == "reinhard2002")
-      image::tonemap::Reinhard2002().applyTo(colorFilm);
+      image::tonemap::Reinhard2002().applyTo(film);
     else if (tonemap == "reinhard2005")
-      image::tonemap::Reinhard2005().applyTo(colorFilm);
+      image::tonemap::Reinhard2005().applyTo(film);
     else
       throw std::runtime_error("Unknown tonemap");
 
-    image::write(filename, colorFilm);
+    image::write(name, film);
+  };
+
+  // Render
+  if (timeBudget > 0 && adaptiveThreshold > 0)
+    throw std::runtime_error("--time-budget and --adaptive-threshold cannot be combined");
+  if ((!checkpointFile.empty() || !shardArg.empty()) && (timeBudget > 0 || adaptiveThreshold > 0))
+    throw std::runtime_error("--checkpoint and --shard cannot be combined with --time-budget or --adaptive-threshold");
+  if (!shardArg.empty() && !checkpointFile.empty())
+    throw std::runtime_error("--shard saves its progress to -o, --checkpoint is not needed");
+  if (resume && checkpointFile.empty() && shardArg.empty())
+    throw std::runtime_error("--resume needs --checkpoint or --shard");
+
+  if (timeBudget > 0) {
+    if (integrator != "pathtracer")
+      throw std::runtime_error("--time-budget is only supported by the pathtracer");
+
+    pathtracer::TimeBudget budget;
+    budget.budget = std::chrono::milliseconds(static_cast<long>(timeBudget * 1000));
+    budget.snapshotInterval = std::chrono::milliseconds(static_cast<long>(snapshotEvery * 1000));
+    budget.snapshot = [&](const image::Film &film) {
+      image::Film snapshot = film;
+      saveColor(snapshot, "snapshot_" + filename);
+    };
+    pathtracer::render(scene.camera, scene, budget, maxDepth, sampler, samplerConfig, rr, tiles);
+  }
+  else if (adaptiveThreshold > 0) {
+    if (integrator != "pathtracer")
+      throw std::runtime_error("--adaptive-threshold is only supported by the pathtracer");
+
+    pathtracer::AdaptiveSampling adaptive;
+    adaptive.spp = spp;
+    adaptive.threshold = adaptiveThreshold;
+    adaptive.maxSpp = maxSpp;
+    pathtracer::render(scene.camera, scene, adaptive, maxDepth, sampler, samplerConfig, rr, tiles);
   }
+  else if (!checkpointFile.empty() || !shardArg.empty()) {
+    if (integrator != "pathtracer")
+      throw std::runtime_error("--checkpoint and --shard are only supported by the pathtracer");
+
+    pathtracer::Checkpointing checkpointing;
+    checkpointing.spp = spp;
+    checkpointing.filename = shardArg.empty() ? checkpointFile : filename;
+    checkpointing.scene = scn + " " + camera;
+    checkpointing.interval = std::chrono::milliseconds(static_cast<long>(checkpointEvery * 1000));
+    checkpointing.resume = resume;
+    if (!shardArg.empty()) {
+      const size_t slash = shardArg.find('/');
+      if (slash == std::string::npos)
+        throw std::runtime_error("--shard must be i/N");
+      checkpointing.shard.index = std::stoul(shardArg.substr(0, slash));
+      checkpointing.shard.count = std::stoul(shardArg.substr(slash + 1));
+      if (checkpointing.shard.count == 0 || checkpointing.shard.index >= checkpointing.shard.count)
+        throw std::runtime_error("--shard i/N needs 0 <= i < N");
+      checkpointing.shard.partition = (args["--shard-by"][0] == "tiles") ? image::ShardPartition::Tiles : image::ShardPartition::Samples;
+    }
+
+    if (!pathtracer::render(scene.camera, scene, checkpointing, maxDepth, sampler, samplerConfig, rr, tiles)) {
+      std::cerr << "Render stopped, continue it with the same arguments and --resume" << std::endl;
+      return 1;
+    }
+    if (!shardArg.empty()) return 0; // The shard is the output
+  }
+  else if (integrator == "pathtracer")
+    pathtracer::render(scene.camera, scene, spp, maxDepth, sampler, samplerConfig, rr, tiles);
+  else if (integrator == "photonmapper")
+    photonmapper::render(scene.camera, scene, spp, maxDepth, N, k, radius, nee, sampler, samplerConfig, tiles); // TODO: args
+  else if (integrator == "wavefront")
+    wavefront::render(scene.camera, scene, spp, maxDepth, sampler, samplerConfig, rr);
+
+  auto &colorFilm = scene.camera->film;
+  auto &normalFilm = scene.camera->nFilm;
+  auto &depthFilm = scene.camera->dFilm;
+  auto &samplesFilm = scene.camera->sFilm;
+
+  saveColor(colorFilm, filename);
 
   if (saveNormals) {
     image::tonemap::Reinhard2002().applyTo(normalFilm);
@@ -215,6 +397,11 @@ int ver(int argc, char **argv) {
     image::write("depth_" + filename, depthFilm);
   }
 
+  if (saveSamples) {
+    image::tonemap::Gamma(1, samplesFilm.max()).applyTo(samplesFilm);
+    image::write("samples_" + filename, samplesFilm);
+  }
+
   return 0;
 }
 
@@ -223,28 +410,47 @@ void merge(const std::unordered_map<std::string, std::vector<std::string>> &args
   const std::string filename = args.at("-o")[0];
   const std::string tonemap = args.at("-t")[0];
   const Float gamma = std::stof(args.at("-g")[0]);
-  const Float k = static_cast<Float>(files.size());
+  const bool saveHDR = args.at("--hdr")[0] == "true";
+
+  image::Film out(0, 0, 0);
+  if (image::isAccumulation(files[0])) {
+    // Every pixel is the mean of all the samples the shards took of it
+    const image::Accumulation acc = image::merge(files);
+    out = image::Film(acc.width, acc.height, 10000); // As Camera
+    #pragma omp parallel for
+    for (size_t i = 0; i < acc.width * acc.height; i++) {
+      const Spectrum L = (acc.count[i] > 0) ? acc.sum[i] / acc.count[i] : Spectrum();
+      out[i] = image::Pixel(L.x, L.y, L.z);
+    }
+  } else {
+    const Float k = static_cast<Float>(files.size());
 
-  image::Film out = image::read(files[0]);
-  const size_t width = out.getWidth();
-  const size_t height = out.getHeight();
-  const size_t colorRes = out.getColorRes();
+    out = image::read(files[0]);
+    const size_t width = out.getWidth();
+    const size_t height = out.getHeight();
+    const size_t colorRes = out.getColorRes();
 
-  std::cout << "Merging " << files[0] << std::endl;
-  for (size_t i = 1; i < files.size(); i++) {
-    std::cout << "Merging " << files[i] << std::endl;
-    const image::Film file = image::read(files[i]);
-    const size_t w = file.getWidth();
-    const size_t h = file.getHeight();
-    const size_t c = file.getColorRes();
+    std::cout << "Merging " << files[0] << std::endl;
+    for (size_t i = 1; i < files.size(); i++) {
+      std::cout << "Merging " << files[i] << std::endl;
+      const image::Film file = image::read(files[i]);
+      const size_t w = file.getWidth();
+      const size_t h = file.getHeight();
+      const size_t c = file.getColorRes();
 
-    if (w != width || h != height || c != colorRes)
-      throw std::runtime_error("Images must have the same dimensions and color resolution");
+      if (w != width || h != height || c != colorRes)
+        throw std::runtime_error("Images must have the same dimensions and color resolution");
 
-    out.buffer += file.buffer;
+      out.buffer += file.buffer;
+    }
+
+    out.buffer /= k;
   }
 
-  out.buffer /= k;
+  if (saveHDR) {
+    image::write(filename + ".hdr", out);
+    return;
+  }
 
   if (tonemap == "gamma")
     image::tonemap::Gamma(gamma, out.max()).applyTo(out);
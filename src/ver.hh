@@ -27,8 +27,8 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <algorithm>
+#include <limits>
 #include <memory>
-#include <random>
 
 #ifndef EMSCRIPTEN
 #include <omp.h>
@@ -38,14 +38,6 @@
 typedef float Float;
 //typedef double Float;
 
-inline
-Float uniform(Float min, Float max, uint seed = 5489u) {
-  static thread_local std::mt19937 generator(seed);
-  std::uniform_real_distribution<Float> distr(min, max);
-  return distr(generator);
-}
-
-
 [[nodiscard]] constexpr Float lerp(Float t, Float v1, Float v2) { return (1 - t) * v1 + t * v2; }
 [[nodiscard]] constexpr Float gamma(int n) {
   Float eps = std::numeric_limits<Float>::epsilon() * 0.5;
@@ -6,13 +6,15 @@
 #include "image/tonemap.hh"
 
 Viewer::Viewer(size_t width, size_t height, size_t max_depth, HemisphereSampler sampler_)
-  : currentScene(0), maxDepth(max_depth), sampler(sampler_), mode(Mode::IMAGE), idx(0), spp(1), camera({0}) {
+  : currentScene(0), maxDepth(max_depth), sampler(sampler_), mode(Mode::IMAGE), animating(false), bvhRebuilds(0), tiles(width, height), idx(0), spp(1), camera({0}) {
   
   scenes[0] = CornellBox(width, height, "pinhole", 5);
   scenes[1] = Bunny(width, height, "pinhole");
+  scenes[2] = Bunnies(width, height, "pinhole");
 
   scenes[0].makeBVH();
   scenes[1].makeBVH();
+  scenes[2].makeBVH();
 
   // int width = scene.camera->film.getWidth();
   // int height = scene.camera->film.getHeight();
@@ -32,7 +34,7 @@ Viewer::Viewer(size_t width, size_t height, size_t max_depth, HemisphereSampler
   target = raylib::LoadRenderTexture(width, height);
   buffer = new raylib::Color[width * height];
 
-  for (size_t i = 0; i < 2; i++) {
+  for (size_t i = 0; i < 3; i++) {
     resetFront[i] = scenes[i].camera->forward;
     resetLeft[i] = scenes[i].camera->left;
     resetUp[i] = scenes[i].camera->up;
@@ -52,6 +54,7 @@ void Viewer::run() {
       
   while (!raylib::WindowShouldClose()) {
     handleInput();
+    if (animating) animate();
     render();
 
     // Copy pathtracer buffer
@@ -95,34 +98,50 @@ void Viewer::run() {
 }
   
 void Viewer::render() {
-  size_t width = scenes[0].camera->film.getWidth();
-  size_t height = scenes[0].camera->film.getHeight();
-
-  #pragma omp parallel
-  for (size_t k = 0; k < 512*2; k++) {
-    size_t i = idx % width;
-    size_t j = idx / width;
-    idx++;
-
-    SurfaceInteraction si;
-    si.t = 0;
-    si.n = Direction(0, 0, 0);
+  // About 1024 pixels (four 16x16 tiles) per thread and frame, tiles.run
+  // spreads the tiles of a frame over the threads so all of them get some
+  const size_t tilesPerFrame = 4 * static_cast<size_t>(omp_get_max_threads());
+  const size_t last = std::min(idx + tilesPerFrame, tiles.size());
+
+  tiles.run(idx, last, [&](const utils::Tile &tile) {
+    const Camera &cam = *scenes[currentScene].camera;
+    const std::unique_ptr<Sampler> samples = makeSampler(SamplerConfig());
+    std::vector<Spectrum> L(tile.width * tile.height);
+    for (size_t j = 0; j < tile.height; j++) {
+      for (size_t i = 0; i < tile.width; i++) {
+        // Every pass over the image is the next sample of its pixels
+        samples->start((tile.y0 + j) * cam.film.getWidth() + tile.x0 + i, spp);
+        Ray r = cam.getRay(tile.x0 + i, tile.y0 + j, *samples);
+        L[j * tile.width + i] = pathtracer::Li(r, scenes[currentScene], maxDepth, sampler, *samples);
+      }
+    }
 
-    Spectrum L;
-    Ray r = scenes[currentScene].camera->getRay(i, j);
+    for (size_t j = 0; j < tile.height; j++)
+      for (size_t i = 0; i < tile.width; i++)
+        scenes[currentScene].camera->writeColor(tile.x0 + i, tile.y0 + j, L[j * tile.width + i]);
+  });
 
-    scenes[currentScene].intersect(r, si);
-    L += pathtracer::Li(r, scenes[currentScene], maxDepth, sampler);
+  idx = last;
+  if (idx >= tiles.size()) {
+    idx = 0;
+    spp++;
+  }
+}
 
-    scenes[currentScene].camera->writeColor(i, j, L);
-    // scene.camera->writeNormal(i, j, si.n);
-    // camera->writeDepth(i, j, si.t);
+// Spins every instance of the current scene around its own up axis and
+// refits the BVH (rebuilding it when refitting made it too slow)
+void Viewer::animate() {
+  Scene &scene = scenes[currentScene];
+  if (scene.instances.empty()) return;
 
-    if (idx >= width * height) {
-      idx = 0;
-      spp++;
-    }
+  const float dt = raylib::GetFrameTime();
+  for (size_t k = 0; k < scene.instances.size(); k++) {
+    Instance *instance = scene.instances[k];
+    instance->setTransform(instance->transform() * Mat4::rotate(dt * (1 + 0.25 * k), 0, 1, 0));
   }
+
+  if (scene.updateBVH()) bvhRebuilds++;
+  resetTarget();
 }
 
 void Viewer::tonemap(image::Film &film) {
@@ -152,8 +171,15 @@ void Viewer::handleInput() {
   } else if (raylib::IsKeyPressed(raylib::KEY_TWO)) {
     currentScene = 1;
     resetTarget();
+  } else if (raylib::IsKeyPressed(raylib::KEY_THREE)) {
+    currentScene = 2;
+    resetTarget();
   }
 
+  // Animate instances
+  if (raylib::IsKeyPressed(raylib::KEY_P))
+    animating = !animating;
+
   // Movement
   if (mode == Mode::GAME) {
     // Keyboard
@@ -273,6 +299,13 @@ void Viewer::DrawHUD() {
 
   raylib::DrawText("R: Reset", 10, 50, 10, raylib::RAYWHITE);
 
+  if (animating) {
+    std::string anim_str = "P: Animating (BVH rebuilds: " + std::to_string(bvhRebuilds) + ")";
+    raylib::DrawText(anim_str.c_str(), 10, 140, 10, raylib::RAYWHITE);
+  } else {
+    raylib::DrawText("P: Animate", 10, 140, 10, raylib::RAYWHITE);
+  }
+
   raylib::DrawText("(TAB)", 10, 65, 10, raylib::RAYWHITE);
   raylib::DrawText(mode_str.c_str(), 45, 65, 10, mode_color);
 
@@ -5,6 +5,7 @@
 #include "scene.hh"
 #include "ver.hh"
 #include "integrators/pathtracer.hh"
+#include "utils/tiles.hh"
 
 namespace raylib {
   #include "raylib.h"
@@ -25,14 +26,17 @@ class Viewer {
       GAME
     };
 
-    Scene scenes[2];
+    Scene scenes[3];
     size_t currentScene;
     size_t maxDepth;
     HemisphereSampler sampler;
 
     Mode mode;
+    bool animating;
+    size_t bvhRebuilds;
 
-    size_t idx;
+    utils::TileScheduler tiles;
+    size_t idx; // Next tile to render
     size_t spp;
 
     raylib::Camera2D camera;
@@ -43,11 +47,12 @@ class Viewer {
     float dstXOffset, dstYOffset;
     float aspectRatio;
 
-    Direction resetFront[2], resetLeft[2], resetUp[2];
-    Point resetEye[2];
+    Direction resetFront[3], resetLeft[3], resetUp[3];
+    Point resetEye[3];
   
   private:
     void render();
+    void animate();
     void tonemap(image::Film &film);
     void handleInput();
     void DrawHUD();